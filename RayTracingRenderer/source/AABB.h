@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Vector3.h"
+
+#include <algorithm>
+
+namespace rtr
+{
+	class AABB
+	{
+	public:
+		AABB() : minimum(consts::infinity, consts::infinity, consts::infinity), maximum(-consts::infinity, -consts::infinity, -consts::infinity) {}
+		AABB(const Point3& minimum, const Point3& maximum) : minimum(minimum), maximum(maximum) {}
+
+		Point3 Min() const
+		{
+			return minimum;
+		}
+
+		Point3 Max() const
+		{
+			return maximum;
+		}
+
+		Point3 Centroid() const
+		{
+			return 0.5 * (minimum + maximum);
+		}
+
+		Vector3 Diagonal() const
+		{
+			return maximum - minimum;
+		}
+
+		bool IsEmpty() const
+		{
+			return minimum.X() > maximum.X() || minimum.Y() > maximum.Y() || minimum.Z() > maximum.Z();
+		}
+
+		int LongestAxis() const
+		{
+			auto diagonal = Diagonal();
+			if (diagonal.X() > diagonal.Y() && diagonal.X() > diagonal.Z())
+			{
+				return 0;
+			}
+			return diagonal.Y() > diagonal.Z() ? 1 : 2;
+		}
+
+	private:
+		Point3 minimum;
+		Point3 maximum;
+	};
+
+	inline double Axis(const Vector3& v, int axis)
+	{
+		return axis == 0 ? v.X() : (axis == 1 ? v.Y() : v.Z());
+	}
+
+	inline AABB Union(const AABB& a, const AABB& b)
+	{
+		return AABB(
+			Point3(std::min(a.Min().X(), b.Min().X()), std::min(a.Min().Y(), b.Min().Y()), std::min(a.Min().Z(), b.Min().Z())),
+			Point3(std::max(a.Max().X(), b.Max().X()), std::max(a.Max().Y(), b.Max().Y()), std::max(a.Max().Z(), b.Max().Z())));
+	}
+
+	inline AABB Union(const AABB& box, const Point3& p)
+	{
+		return Union(box, AABB(p, p));
+	}
+}
@@ -0,0 +1,287 @@
+#pragma once
+
+#include "Color.h"
+#include "Numa.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+namespace rtr
+{
+	// Running sums of linear radiance, squared luminance and sample counts per pixel, rows from the top of
+	// the image. Passes add to it, so it can be turned into an image after any of them.
+	class AccumulationBuffer
+	{
+	public:
+		AccumulationBuffer(int width, int height) : width(width), height(height), ownedStorage(StorageBytes(width, height))
+		{
+			SetStorage(ownedStorage.data());
+			Reset();
+		}
+
+		// Views StorageBytes(width, height) bytes of memory laid out as Write writes them, e.g. a shared memory
+		// segment, without clearing it. The memory must outlive the buffer. Copies always own their storage.
+		AccumulationBuffer(int width, int height, void* storage) : width(width), height(height)
+		{
+			SetStorage(storage);
+		}
+
+		AccumulationBuffer(const AccumulationBuffer& other) : width(other.width), height(other.height)
+		{
+			const auto* otherStorage = reinterpret_cast<const unsigned char*>(other.sums);
+			ownedStorage.assign(otherStorage, otherStorage + StorageBytes(width, height));
+			SetStorage(ownedStorage.data());
+		}
+
+		AccumulationBuffer(AccumulationBuffer&& other) noexcept
+			: width(other.width), height(other.height), ownedStorage(std::move(other.ownedStorage))
+		{
+			SetStorage(ownedStorage.empty() ? static_cast<void*>(other.sums) : ownedStorage.data());
+		}
+
+		// Replaces the contents and the storage: assigning to a view leaves the viewed memory alone.
+		AccumulationBuffer& operator=(AccumulationBuffer other) noexcept
+		{
+			width = other.width;
+			height = other.height;
+			ownedStorage = std::move(other.ownedStorage);
+			SetStorage(ownedStorage.empty() ? static_cast<void*>(other.sums) : ownedStorage.data());
+			return *this;
+		}
+
+		// Bytes of storage a view of an image of this size needs.
+		static size_t StorageBytes(int width, int height)
+		{
+			return static_cast<size_t>(width) * height * (4 * sizeof(float) + sizeof(uint32_t));
+		}
+
+		int Width() const
+		{
+			return width;
+		}
+
+		int Height() const
+		{
+			return height;
+		}
+
+		void Reset()
+		{
+			const size_t pixelsCount = PixelsCount();
+			std::fill(sums, sums + pixelsCount * 3, 0.0f);
+			std::fill(squaredLuminanceSums, squaredLuminanceSums + pixelsCount, 0.0f);
+			std::fill(sampleCounts, sampleCounts + pixelsCount, 0u);
+		}
+
+		// Clears pixels [x0, x1) of row y.
+		void ClearRow(int y, int x0, int x1)
+		{
+			size_t row = static_cast<size_t>(y) * width;
+			std::fill(sums + (row + x0) * 3, sums + (row + x1) * 3, 0.0f);
+			std::fill(squaredLuminanceSums + row + x0, squaredLuminanceSums + row + x1, 0.0f);
+			std::fill(sampleCounts + row + x0, sampleCounts + row + x1, 0u);
+		}
+
+		// Returns the memory to the system (see numa::ReleasePages); contents read back as zeros. Viewed memory
+		// may be shared, so it is only cleared.
+		void ReleasePages()
+		{
+			if (ownedStorage.empty())
+			{
+				Reset();
+				return;
+			}
+			numa::ReleasePages(ownedStorage.data(), ownedStorage.size());
+		}
+
+		void Add(int x, int y, const Color& sampleSum, double squaredLuminanceSum, int samplesCount)
+		{
+			size_t index = static_cast<size_t>(y) * width + x;
+			sums[index * 3] += static_cast<float>(sampleSum.R());
+			sums[index * 3 + 1] += static_cast<float>(sampleSum.G());
+			sums[index * 3 + 2] += static_cast<float>(sampleSum.B());
+			squaredLuminanceSums[index] += static_cast<float>(squaredLuminanceSum);
+			sampleCounts[index] += samplesCount;
+		}
+
+		uint32_t SampleCount(int x, int y) const
+		{
+			return sampleCounts[static_cast<size_t>(y) * width + x];
+		}
+
+		Color Mean(int x, int y) const
+		{
+			size_t index = static_cast<size_t>(y) * width + x;
+			if (sampleCounts[index] == 0)
+			{
+				return Color(0.0, 0.0, 0.0);
+			}
+			return Color(sums[index * 3], sums[index * 3 + 1], sums[index * 3 + 2]) / sampleCounts[index];
+		}
+
+		// Standard error of the pixel's mean luminance after gamma correction, estimated from the sample variance
+		// (the display value is sqrt(L), so an error dL shows as dL / (2 sqrt(L))). Infinite below two samples.
+		double DisplayError(int x, int y) const
+		{
+			size_t index = static_cast<size_t>(y) * width + x;
+			const double samplesCount = sampleCounts[index];
+			if (samplesCount < 2)
+			{
+				return std::numeric_limits<double>::infinity();
+			}
+
+			const double mean = Color(sums[index * 3], sums[index * 3 + 1], sums[index * 3 + 2]).Luminance() / samplesCount;
+			const double variance = std::max(0.0, squaredLuminanceSums[index] / samplesCount - mean * mean) * samplesCount / (samplesCount - 1);
+			const double standardError = std::sqrt(variance / samplesCount);
+			return standardError / (2.0 * std::sqrt(std::max(mean, 1e-4)));
+		}
+
+		// Sample counts as colors from blue (fewest) to red (most) in the RGB layout of the render buffers.
+		void SampleCountHeatmap(std::vector<float>& imageOutBuffer) const
+		{
+			const size_t pixelsCount = PixelsCount();
+			imageOutBuffer.resize(pixelsCount * 3);
+			if (pixelsCount == 0)
+			{
+				return;
+			}
+			const uint32_t minCount = *std::min_element(sampleCounts, sampleCounts + pixelsCount);
+			const uint32_t maxCount = *std::max_element(sampleCounts, sampleCounts + pixelsCount);
+			const double range = std::max<double>(1.0, maxCount - minCount);
+			for (size_t index = 0; index < pixelsCount; index++)
+			{
+				const double t = (sampleCounts[index] - minCount) / range;
+				imageOutBuffer[index * 3] = static_cast<float>(std::clamp(2.0 * t - 0.5, 0.0, 1.0));
+				imageOutBuffer[index * 3 + 1] = static_cast<float>(1.0 - std::abs(2.0 * t - 1.0));
+				imageOutBuffer[index * 3 + 2] = static_cast<float>(std::clamp(1.5 - 2.0 * t, 0.0, 1.0));
+			}
+		}
+
+		// Gamma corrected, clamped mean of every pixel in the RGB layout of the render buffers.
+		void Snapshot(std::vector<float>& imageOutBuffer, int threadsCount = parallel::DefaultThreadsCount()) const
+		{
+			imageOutBuffer.resize(PixelsCount() * 3);
+			parallel::For(0, height, threadsCount, [&](int y)
+				{
+					for (int x = 0; x < width; x++)
+					{
+						size_t index = static_cast<size_t>(y) * width + x;
+						Color pixelColor(sums[index * 3], sums[index * 3 + 1], sums[index * 3 + 2]);
+						if (sampleCounts[index] > 0)
+						{
+							pixelColor.Normalize(sampleCounts[index]);
+						}
+						pixelColor.CorrectGamma();
+						imageOutBuffer[index * 3] = static_cast<float>(pixelColor.R());
+						imageOutBuffer[index * 3 + 1] = static_cast<float>(pixelColor.G());
+						imageOutBuffer[index * 3 + 2] = static_cast<float>(pixelColor.B());
+					}
+				});
+		}
+
+		// Raw sums and counts, in the layout Read expects. Dimensions are not included.
+		void Write(std::ostream& stream) const
+		{
+			stream.write(reinterpret_cast<const char*>(sums), StorageBytes(width, height));
+		}
+
+		bool Read(std::istream& stream)
+		{
+			stream.read(reinterpret_cast<char*>(sums), StorageBytes(width, height));
+			return static_cast<bool>(stream);
+		}
+
+		// Raw sums and counts of pixels [x0, x1) x [y0, y1), row after row, in the layout AddRegion expects.
+		void WriteRegion(std::ostream& stream, int x0, int y0, int x1, int y1) const
+		{
+			for (int y = y0; y < y1; y++)
+			{
+				const size_t row = static_cast<size_t>(y) * width;
+				stream.write(reinterpret_cast<const char*>(sums + (row + x0) * 3), static_cast<size_t>(x1 - x0) * 3 * sizeof(float));
+				stream.write(reinterpret_cast<const char*>(squaredLuminanceSums + row + x0), static_cast<size_t>(x1 - x0) * sizeof(float));
+				stream.write(reinterpret_cast<const char*>(sampleCounts + row + x0), static_cast<size_t>(x1 - x0) * sizeof(uint32_t));
+			}
+		}
+
+		// Adds a region written by WriteRegion, e.g. samples of the same pixels rendered elsewhere. Nothing is
+		// added when the stream ends early.
+		bool AddRegion(std::istream& stream, int x0, int y0, int x1, int y1)
+		{
+			const size_t rowWidth = static_cast<size_t>(x1 - x0);
+			std::vector<float> regionSums(rowWidth * 3 * (y1 - y0));
+			std::vector<float> regionSquaredLuminanceSums(rowWidth * (y1 - y0));
+			std::vector<uint32_t> regionSampleCounts(rowWidth * (y1 - y0));
+			for (int y = y0; y < y1; y++)
+			{
+				const size_t row = static_cast<size_t>(y - y0) * rowWidth;
+				stream.read(reinterpret_cast<char*>(regionSums.data() + row * 3), rowWidth * 3 * sizeof(float));
+				stream.read(reinterpret_cast<char*>(regionSquaredLuminanceSums.data() + row), rowWidth * sizeof(float));
+				stream.read(reinterpret_cast<char*>(regionSampleCounts.data() + row), rowWidth * sizeof(uint32_t));
+			}
+			if (!stream)
+			{
+				return false;
+			}
+
+			for (int y = y0; y < y1; y++)
+			{
+				const size_t row = static_cast<size_t>(y) * width;
+				const size_t regionRow = static_cast<size_t>(y - y0) * rowWidth;
+				for (size_t x = 0; x < rowWidth; x++)
+				{
+					for (int c = 0; c < 3; c++)
+					{
+						sums[(row + x0 + x) * 3 + c] += regionSums[(regionRow + x) * 3 + c];
+					}
+					squaredLuminanceSums[row + x0 + x] += regionSquaredLuminanceSums[regionRow + x];
+					sampleCounts[row + x0 + x] += regionSampleCounts[regionRow + x];
+				}
+			}
+			return true;
+		}
+
+		// FNV-1a over the raw contents, to detect torn or corrupted copies.
+		uint64_t Checksum() const
+		{
+			uint64_t hash = 0xcbf29ce484222325ull;
+			auto addBytes = [&](const void* data, size_t bytes)
+			{
+				const auto* bytePointer = static_cast<const unsigned char*>(data);
+				for (size_t b = 0; b < bytes; b++)
+				{
+					hash = (hash ^ bytePointer[b]) * 0x100000001b3ull;
+				}
+			};
+			addBytes(sums, StorageBytes(width, height));
+			return hash;
+		}
+
+	private:
+		size_t PixelsCount() const
+		{
+			return static_cast<size_t>(width) * height;
+		}
+
+		// Sums, squared luminance sums and counts, one after another.
+		void SetStorage(void* storage)
+		{
+			const size_t pixelsCount = PixelsCount();
+			sums = static_cast<float*>(storage);
+			squaredLuminanceSums = sums + pixelsCount * 3;
+			sampleCounts = reinterpret_cast<uint32_t*>(squaredLuminanceSums + pixelsCount);
+		}
+
+		int width;
+		int height;
+		std::vector<unsigned char> ownedStorage; // Empty for views.
+		float* sums = nullptr;
+		float* squaredLuminanceSums = nullptr;
+		uint32_t* sampleCounts = nullptr;
+	};
+}
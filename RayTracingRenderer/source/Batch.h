@@ -0,0 +1,166 @@
+#pragma once
+
+#include "Camera.h"
+#include "Constants.h"
+#include "Image.h"
+#include "Renderer.h"
+#include "Scene.h"
+
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace rtr
+{
+	struct BatchFrame
+	{
+		CameraSettings camera;
+		std::string fileName; // The denoised frame is saved here; nothing is saved when empty.
+	};
+
+	struct BatchReport
+	{
+		int framesCount = 0;
+		double sceneBuildMs = 0.0;
+		double renderMs = 0.0;         // Rendering alone, summed over the frames.
+		double totalMs = 0.0;          // From the start of the scene build until the last frame is saved.
+		double amortizedFrameMs = 0.0; // totalMs / framesCount.
+	};
+
+	// Called on the output thread with every denoised frame, in order.
+	using FrameCallback = std::function<void(size_t frame, const std::vector<float>& image)>;
+
+	// Renders every frame of one scene with the renderer's settings. The scene, with its light hierarchy and
+	// environment tables, is built once, the worker threads and the denoiser stay up between frames, and
+	// each frame is denoised and saved on an output thread while the next one renders.
+	inline BatchReport RenderBatch(Renderer& renderer, const std::function<Scene()>& buildScene, const std::vector<BatchFrame>& frames, int samplesPerPixel, int maxDepth,
+		const FrameCallback& onFrame = nullptr)
+	{
+		using Clock = std::chrono::steady_clock;
+		auto elapsedMs = [](Clock::time_point startTime)
+		{
+			return std::chrono::duration<double, std::milli>(Clock::now() - startTime).count();
+		};
+
+		BatchReport report;
+		report.framesCount = static_cast<int>(frames.size());
+		const auto startTime = Clock::now();
+		const Scene scene = buildScene();
+		report.sceneBuildMs = elapsedMs(startTime);
+
+		struct FrameBuffers
+		{
+			size_t frame = 0;
+			std::vector<float> image, albedo, normal, output;
+		};
+
+		// At most one frame waits for the output thread, so the buffers of three frames are alive at a time.
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::unique_ptr<FrameBuffers> pending;
+		std::vector<std::unique_ptr<FrameBuffers>> spare;
+		bool finished = false;
+
+		std::thread output([&]()
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				while (true)
+				{
+					changed.wait(lock, [&]() { return pending != nullptr || finished; });
+					if (pending == nullptr)
+					{
+						return;
+					}
+					auto buffers = std::move(pending);
+					changed.notify_all();
+					lock.unlock();
+
+					renderer.DenoiseImage(buffers->image, buffers->albedo, buffers->normal, buffers->output);
+					const auto& fileName = frames[buffers->frame].fileName;
+					if (!fileName.empty())
+					{
+						SaveImage(fileName, buffers->output, renderer.OutputWidth(), renderer.OutputHeight());
+					}
+					if (onFrame)
+					{
+						onFrame(buffers->frame, buffers->output);
+					}
+
+					lock.lock();
+					spare.push_back(std::move(buffers));
+				}
+			});
+
+		const size_t bufferSize = static_cast<size_t>(renderer.OutputWidth()) * renderer.OutputHeight() * 3;
+		for (size_t frame = 0; frame < frames.size(); frame++)
+		{
+			std::unique_ptr<FrameBuffers> buffers;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!spare.empty())
+				{
+					buffers = std::move(spare.back());
+					spare.pop_back();
+				}
+			}
+			if (buffers == nullptr)
+			{
+				buffers = std::make_unique<FrameBuffers>();
+				for (auto* buffer : { &buffers->image, &buffers->albedo, &buffers->normal, &buffers->output })
+				{
+					buffer->resize(bufferSize, 0.0f);
+				}
+			}
+			buffers->frame = frame;
+
+			const auto renderStartTime = Clock::now();
+			renderer.RenderImageWithFeatures(frames[frame].camera.Create(), scene, samplesPerPixel, maxDepth, buffers->image, &buffers->albedo, &buffers->normal);
+			report.renderMs += elapsedMs(renderStartTime);
+
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [&]() { return pending == nullptr; });
+			pending = std::move(buffers);
+			changed.notify_all();
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [&]() { return pending == nullptr; });
+			finished = true;
+		}
+		changed.notify_all();
+		output.join();
+
+		report.totalMs = elapsedMs(startTime);
+		report.amortizedFrameMs = frames.empty() ? 0.0 : report.totalMs / frames.size();
+		return report;
+	}
+
+	// Frames circling the look-at point of camera at its distance and height, starting from its position.
+	inline std::vector<BatchFrame> OrbitFrames(const CameraSettings& camera, int framesCount, const std::string& filePrefix)
+	{
+		std::vector<BatchFrame> frames(framesCount);
+		const Vector3 offset = camera.position - camera.lookAt;
+		const double radius = std::sqrt(offset.X() * offset.X() + offset.Z() * offset.Z());
+		const double startAngle = std::atan2(offset.Z(), offset.X());
+		for (int f = 0; f < framesCount; f++)
+		{
+			const double angle = startAngle + 2.0 * consts::pi * f / framesCount;
+			frames[f].camera = camera;
+			frames[f].camera.position = camera.lookAt + Vector3(radius * std::cos(angle), offset.Y(), radius * std::sin(angle));
+			if (!filePrefix.empty())
+			{
+				const std::string number = std::to_string(f);
+				frames[f].fileName = filePrefix + std::string(number.size() < 3 ? 3 - number.size() : 0, '0') + number + ".bmp";
+			}
+		}
+		return frames;
+	}
+}
@@ -0,0 +1,851 @@
+#pragma once
+
+#include "Batch.h"
+#include "Camera.h"
+#include "Color.h"
+#include "Distributed.h"
+#include "Image.h"
+#include "Numa.h"
+#include "Parallel.h"
+#include "PerfCounters.h"
+#include "RenderServer.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "SharedFramebuffer.h"
+#include "Statistics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <signal.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+namespace rtr::bench
+{
+	struct NoiseReport
+	{
+		int samplesPerPixel = 0;
+		double meanStandardError = 0.0;
+		double renderTimeMs = 0.0;
+	};
+
+	// Renders 1 spp passes until the time budget is spent and estimates noise from the per-pixel
+	// sample variance, so no reference image is needed. The linear mean image is written to imageOutBuffer.
+	NoiseReport RenderNoiseAtTimeBudget(const Renderer& renderer, const Camera& camera, const Scene& scene, int imageWidth, int imageHeight, int maxDepth, double timeBudgetMs, std::vector<float>& imageOutBuffer)
+	{
+		const size_t pixelsCount = static_cast<size_t>(imageWidth) * imageHeight;
+		std::vector<Color> sum(pixelsCount);
+		std::vector<double> luminanceSum(pixelsCount, 0.0);
+		std::vector<double> luminanceSquaredSum(pixelsCount, 0.0);
+
+		NoiseReport report;
+		const auto startTime = std::chrono::high_resolution_clock::now();
+		auto elapsedMs = [&]()
+		{
+			return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(std::chrono::high_resolution_clock::now() - startTime).count();
+		};
+
+		while (report.samplesPerPixel == 0 || elapsedMs() < timeBudgetMs)
+		{
+			parallel::For(0, imageHeight, renderer.ThreadsCount(), [&](int k)
+				{
+					int j = imageHeight - 1 - k;
+					auto sampler = renderer.CreateSampler(0, 1);
+					for (int i = 0; i < imageWidth; i++)
+					{
+						size_t index = static_cast<size_t>(k) * imageWidth + i;
+						renderer.StartPixelSample(*sampler, i, k, report.samplesPerPixel);
+						Color sample = renderer.SamplePixel(camera, scene, i, j, maxDepth, *sampler);
+						sum[index] += sample;
+						luminanceSum[index] += sample.Luminance();
+						luminanceSquaredSum[index] += sample.Luminance() * sample.Luminance();
+					}
+				});
+			report.samplesPerPixel++;
+		}
+		report.renderTimeMs = elapsedMs();
+
+		const double n = report.samplesPerPixel;
+		double standardErrorSum = 0.0;
+		for (size_t index = 0; index < pixelsCount; index++)
+		{
+			double mean = luminanceSum[index] / n;
+			double variance = n > 1 ? std::max(0.0, (luminanceSquaredSum[index] - n * mean * mean) / (n - 1)) : 0.0;
+			standardErrorSum += std::sqrt(variance / n);
+
+			Color pixelColor = sum[index];
+			pixelColor.Normalize(report.samplesPerPixel);
+			pixelColor.CorrectGamma();
+			imageOutBuffer[index * 3] = static_cast<float>(pixelColor.R());
+			imageOutBuffer[index * 3 + 1] = static_cast<float>(pixelColor.G());
+			imageOutBuffer[index * 3 + 2] = static_cast<float>(pixelColor.B());
+		}
+		report.meanStandardError = standardErrorSum / pixelsCount;
+
+		return report;
+	}
+
+	// Compares uniform light selection against the light hierarchy at an equal time budget.
+	void BenchmarkLightSampling(const Camera& camera, Scene& scene, int imageWidth, int imageHeight, int maxDepth, double timeBudgetMs, const std::string& outputPrefix)
+	{
+		scene.BuildLightHierarchy();
+
+		std::vector<float> imageBuffer(static_cast<size_t>(imageWidth) * imageHeight * 3, 0.0f);
+		Renderer renderer(imageWidth, imageHeight);
+
+		const std::pair<LightSampling, std::string> strategies[] = { { LightSampling::Uniform, "uniform" }, { LightSampling::Hierarchy, "hierarchy" } };
+		for (const auto& [lightSampling, name] : strategies)
+		{
+			renderer.SetLightSampling(lightSampling);
+			auto report = RenderNoiseAtTimeBudget(renderer, camera, scene, imageWidth, imageHeight, maxDepth, timeBudgetMs, imageBuffer);
+			std::cout << "Light sampling " << name << ": " << report.samplesPerPixel << " spp in " << report.renderTimeMs
+				<< " ms, mean standard error: " << report.meanStandardError << '\n';
+			SaveImage(outputPrefix + name + ".png", imageBuffer, imageWidth, imageHeight);
+		}
+	}
+
+	// Noise vs time of uniform and importance sampled environment lighting.
+	void BenchmarkEnvironmentSampling(const Camera& camera, const Scene& scene, int imageWidth, int imageHeight, int maxDepth, double timeBudgetMs, const std::string& outputPrefix)
+	{
+		std::vector<float> imageBuffer(static_cast<size_t>(imageWidth) * imageHeight * 3, 0.0f);
+		Renderer renderer(imageWidth, imageHeight);
+
+		const std::pair<EnvironmentSampling, std::string> strategies[] = { { EnvironmentSampling::Uniform, "uniform" }, { EnvironmentSampling::Importance, "importance" } };
+		for (const auto& [environmentSampling, name] : strategies)
+		{
+			renderer.SetEnvironmentSampling(environmentSampling);
+			for (double budgetMs : { timeBudgetMs / 4.0, timeBudgetMs / 2.0, timeBudgetMs })
+			{
+				auto report = RenderNoiseAtTimeBudget(renderer, camera, scene, imageWidth, imageHeight, maxDepth, budgetMs, imageBuffer);
+				std::cout << "Environment sampling " << name << ": " << report.samplesPerPixel << " spp in " << report.renderTimeMs
+					<< " ms, mean standard error: " << report.meanStandardError << '\n';
+			}
+			SaveImage(outputPrefix + name + ".png", imageBuffer, imageWidth, imageHeight);
+		}
+	}
+
+	// Render time of the tile scheduler for 1 to maxThreads workers, with speedup and parallel efficiency
+	// (speedup / workers) relative to a single worker.
+	void BenchmarkThreadScaling(const Camera& camera, const Scene& scene, int imageWidth, int imageHeight, int samplesPerPixel, int maxDepth, int maxThreads, int tileSize)
+	{
+		Renderer renderer(imageWidth, imageHeight);
+		renderer.SetTileSize(tileSize);
+		std::vector<float> imageBuffer(static_cast<size_t>(imageWidth) * imageHeight * 3);
+		double singleThreadSeconds = 0.0;
+
+		for (int threadsCount = 1; threadsCount <= maxThreads; threadsCount *= 2)
+		{
+			renderer.SetThreadsCount(threadsCount);
+			const auto startTime = std::chrono::high_resolution_clock::now();
+			renderer.RenderImage(camera, scene, samplesPerPixel, maxDepth, imageBuffer);
+			const auto seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+			singleThreadSeconds = threadsCount == 1 ? seconds : singleThreadSeconds;
+			const double speedup = singleThreadSeconds / seconds;
+			std::cout << "Threads: " << threadsCount << ", tile size: " << tileSize << ", time: " << seconds * 1000.0 << " ms"
+				<< ", speedup: " << speedup << ", efficiency: " << speedup / threadsCount << '\n';
+		}
+	}
+
+	// Render time on the first 1, 2, ... NUMA nodes with all their CPUs, once with unpinned threads and a buffer
+	// touched by the calling thread, once with pinned threads and a buffer first-touched by the tile owners.
+	void BenchmarkNumaPlacement(const Camera& camera, const Scene& scene, int imageWidth, int imageHeight, int samplesPerPixel, int maxDepth)
+	{
+		const auto& nodes = numa::Nodes();
+		Renderer renderer(imageWidth, imageHeight);
+		int threadsCount = 0;
+		for (size_t nodesCount = 1; nodesCount <= nodes.size(); nodesCount++)
+		{
+			threadsCount += static_cast<int>(nodes[nodesCount - 1].size());
+			renderer.SetThreadsCount(threadsCount);
+			for (bool placement : { false, true })
+			{
+				parallel::SetThreadAffinity(placement);
+				std::vector<float> imageBuffer(static_cast<size_t>(imageWidth) * imageHeight * 3, 0.0f);
+				if (placement)
+				{
+					renderer.FirstTouch(imageBuffer);
+				}
+
+				const auto startTime = std::chrono::high_resolution_clock::now();
+				renderer.RenderImage(camera, scene, samplesPerPixel, maxDepth, imageBuffer);
+				const auto milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+				std::cout << "Nodes: " << nodesCount << ", threads: " << threadsCount << ", placement " << (placement ? "on" : "off")
+					<< ": " << milliseconds << " ms\n";
+			}
+		}
+		parallel::SetThreadAffinity(false);
+	}
+
+	// Every tile order at the same settings: render time, time until the tiles covering the central quarter of
+	// the image are done (the first useful preview) and, where hardware counters are available, last level cache
+	// references and misses.
+	void BenchmarkTileOrders(const Camera& camera, const Scene& scene, int imageWidth, int imageHeight, int samplesPerPixel, int maxDepth, int tileSize)
+	{
+		Renderer renderer(imageWidth, imageHeight);
+		renderer.ClearProgressSubscribers();
+		renderer.SetTileSize(tileSize);
+		std::vector<float> imageBuffer(static_cast<size_t>(imageWidth) * imageHeight * 3, 0.0f);
+
+		// Starts the worker threads before the counters attach to them.
+		renderer.RenderImage(camera, scene, 1, maxDepth, imageBuffer);
+		perf::CacheCounters counters;
+		if (!counters.Available())
+		{
+			std::cout << "Cache counters are not available on this system, misses are not reported\n";
+		}
+
+		const Tile center{ imageWidth / 4, imageHeight / 4, imageWidth * 3 / 4, imageHeight * 3 / 4 };
+		auto inCenter = [&](const Tile& tile)
+		{
+			return tile.x0 < center.x1 && tile.x1 > center.x0 && tile.y0 < center.y1 && tile.y1 > center.y0;
+		};
+
+		const std::pair<TileOrder, const char*> orders[] = {
+			{ TileOrder::Scanline, "Scanline" }, { TileOrder::Morton, "Morton" }, { TileOrder::Hilbert, "Hilbert" }, { TileOrder::Spiral, "Spiral" } };
+		for (const auto& [order, name] : orders)
+		{
+			renderer.SetTileOrder(order);
+			const auto tiles = renderer.Tiles();
+			std::atomic<size_t> centerTilesLeft = std::count_if(tiles.begin(), tiles.end(), inCenter);
+			double firstUsefulMs = 0.0;
+
+			counters.Start();
+			const auto startTime = std::chrono::high_resolution_clock::now();
+			TileScheduler(renderer.ThreadsCount()).Run(tiles, [&](const Tile& tile)
+				{
+					auto sampler = renderer.CreateSampler(0, samplesPerPixel);
+					for (int k = tile.y0; k < tile.y1; k++)
+					{
+						for (int i = tile.x0; i < tile.x1; i++)
+						{
+							Color pixelColor = renderer.SamplePixelRange(camera, scene, i, k, 0, samplesPerPixel, maxDepth, *sampler);
+							pixelColor.Normalize(samplesPerPixel);
+							pixelColor.CorrectGamma();
+							size_t index = (static_cast<size_t>(k) * imageWidth + i) * 3;
+							imageBuffer[index] = static_cast<float>(pixelColor.R());
+							imageBuffer[index + 1] = static_cast<float>(pixelColor.G());
+							imageBuffer[index + 2] = static_cast<float>(pixelColor.B());
+						}
+					}
+					if (inCenter(tile) && centerTilesLeft.fetch_sub(1, std::memory_order_relaxed) == 1)
+					{
+						firstUsefulMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+					}
+				});
+			const double renderMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+			counters.Stop();
+
+			std::cout << name << ": " << renderMs << " ms, first useful image " << firstUsefulMs << " ms";
+			if (counters.Available())
+			{
+				std::cout << ", LLC references " << counters.LastLevelCacheReferences() << ", LLC misses " << counters.LastLevelCacheMisses();
+			}
+			std::cout << '\n';
+		}
+	}
+
+	// Beauty, albedo and normal from three separate renders, as main used to produce them (features at a third
+	// of the samples) and at equal sample counts, against one fused render.
+	void BenchmarkFusedFeatures(const Camera& camera, const Scene& scene, int imageWidth, int imageHeight, int samplesPerPixel, int maxDepth)
+	{
+		auto elapsedMs = [](auto startTime)
+		{
+			return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(std::chrono::high_resolution_clock::now() - startTime).count();
+		};
+
+		Renderer renderer(imageWidth, imageHeight);
+		renderer.ClearProgressSubscribers();
+		const size_t bufferSize = static_cast<size_t>(imageWidth) * imageHeight * 3;
+		std::vector<float> separateImage(bufferSize), albedo(bufferSize), normal(bufferSize);
+		std::vector<float> fusedImage(bufferSize), fusedAlbedo(bufferSize), fusedNormal(bufferSize), fusedDepth(bufferSize / 3);
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+		renderer.RenderImage(camera, scene, samplesPerPixel, maxDepth, separateImage);
+		const double imageMs = elapsedMs(startTime);
+
+		double separateMs[2] = {};
+		const int featureSamples[2] = { std::max(1, samplesPerPixel / 3), samplesPerPixel };
+		for (int variant = 0; variant < 2; variant++)
+		{
+			startTime = std::chrono::high_resolution_clock::now();
+			renderer.RenderAlbedo(camera, scene, featureSamples[variant], albedo);
+			renderer.RenderNormal(camera, scene, featureSamples[variant], normal);
+			separateMs[variant] = imageMs + elapsedMs(startTime);
+		}
+
+		startTime = std::chrono::high_resolution_clock::now();
+		renderer.RenderImageWithFeatures(camera, scene, samplesPerPixel, maxDepth, fusedImage, &fusedAlbedo, &fusedNormal, &fusedDepth);
+		const double fusedMs = elapsedMs(startTime);
+
+		float largestDifference = 0.0f;
+		for (size_t i = 0; i < bufferSize; i++)
+		{
+			largestDifference = std::max(largestDifference, std::abs(fusedImage[i] - separateImage[i]));
+		}
+
+		for (int variant = 0; variant < 2; variant++)
+		{
+			std::cout << "Separate passes, features at " << featureSamples[variant] << " spp: " << separateMs[variant] << " ms, fused saves "
+				<< separateMs[variant] - fusedMs << " ms (" << 100.0 * (1.0 - fusedMs / separateMs[variant]) << "%)\n";
+		}
+		std::cout << "Fused pass, features at " << samplesPerPixel << " spp: " << fusedMs << " ms (image alone " << imageMs << " ms), largest image difference "
+			<< largestDifference << '\n';
+	}
+
+	// Distributed render time for 1 to maxWorkers workers on localhost, each a single-threaded renderer on its
+	// own thread talking to the coordinator over TCP like a separate process would, with a speedup chart.
+	// A last run drops one worker after a few tiles to show the requeue. Every assembled buffer is compared
+	// with a local render of the same job.
+	void BenchmarkDistributed(const DistributedJob& job, const SceneFactory& sceneFactory, int maxWorkers)
+	{
+		AccumulationBuffer reference(job.imageWidth, job.imageHeight);
+		{
+			Renderer renderer(job.imageWidth, job.imageHeight);
+			renderer.ClearProgressSubscribers();
+			renderer.SetSeed(job.seed);
+			renderer.RenderToSampleCount(job.camera.Create(), sceneFactory(job.scene), job.samplesPerPixel, job.maxDepth, reference);
+		}
+
+		auto runDistributed = [&](int workersCount, int failingWorkerStopAfter, AccumulationBuffer& accumulation)
+		{
+			Coordinator coordinator(0, net::ListenAddress::Loopback, 60.0);
+			std::vector<std::thread> workers;
+			for (int w = 0; w < workersCount; w++)
+			{
+				const int stopAfter = w == 0 ? failingWorkerStopAfter : 0;
+				workers.emplace_back([&, stopAfter]() { RunWorker("127.0.0.1", coordinator.Port(), sceneFactory, 1, 10.0, stopAfter); });
+			}
+			const DistributedReport report = coordinator.Render(job, accumulation);
+			for (auto& worker : workers)
+			{
+				worker.join();
+			}
+			return report;
+		};
+
+		std::vector<std::pair<int, double>> speedups;
+		double singleWorkerMs = 0.0;
+		for (int workersCount = 1; workersCount <= maxWorkers; workersCount *= 2)
+		{
+			AccumulationBuffer accumulation(job.imageWidth, job.imageHeight);
+			const DistributedReport report = runDistributed(workersCount, 0, accumulation);
+			singleWorkerMs = workersCount == 1 ? report.renderTimeMs : singleWorkerMs;
+			speedups.emplace_back(workersCount, singleWorkerMs / report.renderTimeMs);
+			std::cout << "Workers: " << report.workersCount << ", work items: " << report.workItemsCount << ", time: " << report.renderTimeMs << " ms, speedup: "
+				<< speedups.back().second << ", matches local render: " << (accumulation.Checksum() == reference.Checksum() ? "yes" : "no") << '\n';
+		}
+
+		std::cout << "Speedup over one worker:\n";
+		for (const auto& [workersCount, speedup] : speedups)
+		{
+			std::cout << std::string(3 - std::min<size_t>(3, std::to_string(workersCount).size()), ' ') << workersCount << " | "
+				<< std::string(static_cast<size_t>(std::lround(speedup * 8.0)), '#') << ' ' << speedup << '\n';
+		}
+
+		AccumulationBuffer accumulation(job.imageWidth, job.imageHeight);
+		const int workersCount = std::max(2, maxWorkers);
+		const DistributedReport report = runDistributed(workersCount, 3, accumulation);
+		std::cout << "Workers: " << workersCount << ", one dropping its connection: " << report.renderTimeMs << " ms, failed workers: "
+			<< report.failedWorkersCount << ", requeued work items: " << report.requeuedWorkItemsCount << ", matches local render: "
+			<< (accumulation.Checksum() == reference.Checksum() ? "yes" : "no") << '\n';
+	}
+
+	// Renders the job into a shared framebuffer with processesCount single-threaded worker processes (spawned
+	// from executable with --shared-memory-worker) and with one worker process of processesCount threads, and
+	// compares both with an in-process threaded render: time, peak resident memory of the workers, and whether
+	// the result matches. A last run kills one worker after a quarter of the tiles to show the takeover.
+	void BenchmarkSharedFramebuffer(const std::string& executable, const DistributedJob& job, const SceneFactory& sceneFactory, int processesCount)
+	{
+#if defined(__unix__) || defined(__APPLE__)
+		AccumulationBuffer reference(job.imageWidth, job.imageHeight);
+		const auto startTime = std::chrono::high_resolution_clock::now();
+		{
+			Renderer renderer(job.imageWidth, job.imageHeight);
+			renderer.ClearProgressSubscribers();
+			renderer.SetSeed(job.seed);
+			renderer.SetThreadsCount(processesCount);
+			renderer.SetTileSize(job.tileSize);
+			renderer.RenderToSampleCount(job.camera.Create(), sceneFactory(job.scene), job.samplesPerPixel, job.maxDepth, reference);
+		}
+		const double threadedMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+		rusage selfUsage;
+		getrusage(RUSAGE_SELF, &selfUsage);
+		std::cout << "In-process, " << processesCount << " threads: " << threadedMs << " ms, peak resident memory " << selfUsage.ru_maxrss / 1024 << " MiB (whole benchmark process)\n";
+
+		const std::string name = "/rtr-benchmark-" + std::to_string(getpid());
+		auto runWorkers = [&](int workersCount, int threadsPerWorker, bool killOne)
+		{
+			auto framebuffer = SharedFramebuffer::Create(name, job);
+			if (!framebuffer)
+			{
+				std::cout << "Cannot create the shared memory segment\n";
+				return;
+			}
+
+			const auto runStartTime = std::chrono::high_resolution_clock::now();
+			const std::string threadsArgument = std::to_string(threadsPerWorker);
+			std::vector<pid_t> workers(workersCount, -1);
+			for (auto& worker : workers)
+			{
+				char* arguments[] = { const_cast<char*>(executable.c_str()), const_cast<char*>("--shared-memory-worker"), const_cast<char*>(name.c_str()),
+					const_cast<char*>(threadsArgument.c_str()), nullptr };
+				if (posix_spawn(&worker, executable.c_str(), nullptr, nullptr, arguments, environ) != 0)
+				{
+					worker = -1;
+				}
+			}
+
+			if (killOne)
+			{
+				while (framebuffer->TilesDone() * 4 < static_cast<int>(framebuffer->Tiles().size()))
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+				kill(workers[0], SIGKILL);
+			}
+
+			long peakMemoryKiB = 0;
+			for (pid_t worker : workers)
+			{
+				rusage usage{};
+				int status = 0;
+				if (worker > 0 && wait4(worker, &status, 0, &usage) == worker)
+				{
+					peakMemoryKiB += usage.ru_maxrss;
+				}
+			}
+			const double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - runStartTime).count();
+
+			std::cout << workersCount << " processes x " << threadsPerWorker << " threads" << (killOne ? ", one killed" : "") << ": " << milliseconds
+				<< " ms (" << threadedMs / milliseconds << "x the threaded throughput), peak resident memory of all workers " << peakMemoryKiB / 1024
+				<< " MiB, segment " << framebuffer->SegmentBytes() / 1024 << " KiB, complete: " << (framebuffer->IsComplete() ? "yes" : "no")
+				<< ", matches threaded render: " << (framebuffer->Accumulation().Checksum() == reference.Checksum() ? "yes" : "no") << '\n';
+		};
+
+		runWorkers(1, processesCount, false);
+		runWorkers(processesCount, 1, false);
+		runWorkers(std::max(2, processesCount), 1, true);
+#else
+		(void)executable, (void)job, (void)sceneFactory, (void)processesCount;
+		std::cout << "Shared memory framebuffers need POSIX shared memory\n";
+#endif
+	}
+
+	// The frames rendered the way main renders one image, building the scene, renderer and denoiser and saving
+	// the frame in turn, against one batch. Reports the amortized time per frame.
+	void BenchmarkBatch(const std::function<Scene()>& buildScene, const std::vector<BatchFrame>& frames, int imageWidth, int imageHeight, int samplesPerPixel, int maxDepth)
+	{
+		const size_t bufferSize = static_cast<size_t>(imageWidth) * imageHeight * 3;
+		const auto startTime = std::chrono::high_resolution_clock::now();
+		double sceneBuildMs = 0.0;
+		for (const auto& frame : frames)
+		{
+			const auto buildStartTime = std::chrono::high_resolution_clock::now();
+			const Scene scene = buildScene();
+			sceneBuildMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - buildStartTime).count();
+
+			Renderer renderer(imageWidth, imageHeight);
+			renderer.ClearProgressSubscribers();
+			std::vector<float> image(bufferSize), albedo(bufferSize), normal(bufferSize), output(bufferSize);
+			renderer.RenderImageWithFeatures(frame.camera.Create(), scene, samplesPerPixel, maxDepth, image, &albedo, &normal);
+			renderer.DenoiseImage(image, albedo, normal, output);
+			if (!frame.fileName.empty())
+			{
+				SaveImage(frame.fileName, output, imageWidth, imageHeight);
+			}
+		}
+		const double separateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+		Renderer renderer(imageWidth, imageHeight);
+		renderer.ClearProgressSubscribers();
+		const BatchReport report = RenderBatch(renderer, buildScene, frames, samplesPerPixel, maxDepth);
+
+		std::cout << "Separate runs: " << separateMs << " ms, " << separateMs / frames.size() << " ms per frame (scene builds " << sceneBuildMs << " ms)\n";
+		std::cout << "Batch: " << report.totalMs << " ms, " << report.amortizedFrameMs << " ms per frame (scene build " << report.sceneBuildMs << " ms, rendering "
+			<< report.renderMs << " ms), saves " << 100.0 * (1.0 - report.totalMs / separateMs) << "%\n";
+	}
+
+	// Preview jobs run the way main runs one render (scene, renderer and denoiser built per job) against the
+	// same jobs sent by clientsCount concurrent clients to a render server on localhost. Reports latency
+	// percentiles of both, as seen by the clients, and the server's queue depth.
+	void BenchmarkRenderServer(const RenderRequest& request, const SceneFactory& sceneFactory, int clientsCount, int jobsPerClient)
+	{
+		const int jobsCount = clientsCount * jobsPerClient;
+		std::vector<double> coldLatenciesMs;
+		for (int j = 0; j < jobsCount; j++)
+		{
+			const auto startTime = std::chrono::high_resolution_clock::now();
+			const Scene scene = sceneFactory(request.scene);
+			Renderer renderer(request.imageWidth, request.imageHeight);
+			renderer.ClearProgressSubscribers();
+			const size_t bufferSize = static_cast<size_t>(request.imageWidth) * request.imageHeight * 3;
+			std::vector<float> image(bufferSize), albedo(bufferSize), normal(bufferSize), output(bufferSize);
+			renderer.RenderImageWithFeatures(request.camera.Create(), scene, request.samplesPerPixel, request.maxDepth, image, &albedo, &normal);
+			renderer.DenoiseImage(image, albedo, normal, output);
+			coldLatenciesMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count());
+		}
+
+		RenderServer server(0, sceneFactory);
+		std::thread serverThread([&]() { server.Run(); });
+		std::vector<std::vector<double>> clientLatenciesMs(clientsCount);
+		std::vector<std::thread> clients;
+		const auto startTime = std::chrono::high_resolution_clock::now();
+		for (int c = 0; c < clientsCount; c++)
+		{
+			clients.emplace_back([&, c]()
+				{
+					RenderClient client("127.0.0.1", server.Port());
+					RenderResponse response;
+					for (int j = 0; j < jobsPerClient; j++)
+					{
+						const auto requestTime = std::chrono::high_resolution_clock::now();
+						if (!client.Render(request, response) || !response.ok)
+						{
+							break;
+						}
+						clientLatenciesMs[c].push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - requestTime).count());
+					}
+				});
+		}
+		for (auto& client : clients)
+		{
+			client.join();
+		}
+		const double serverTotalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+		const ServerStats stats = server.Stats();
+		server.Stop();
+		serverThread.join();
+
+		std::vector<double> serverLatenciesMs;
+		for (const auto& latencies : clientLatenciesMs)
+		{
+			serverLatenciesMs.insert(serverLatenciesMs.end(), latencies.begin(), latencies.end());
+		}
+		double coldTotalMs = 0.0;
+		for (double latency : coldLatenciesMs)
+		{
+			coldTotalMs += latency;
+		}
+
+		std::cout << "Separate runs: " << jobsCount << " jobs in " << coldTotalMs << " ms, latency p50 " << stats::Percentile(coldLatenciesMs, 0.5)
+			<< " ms, p90 " << stats::Percentile(coldLatenciesMs, 0.9) << " ms, p99 " << stats::Percentile(coldLatenciesMs, 0.99) << " ms\n";
+		std::cout << "Server, " << clientsCount << " clients: " << serverLatenciesMs.size() << " jobs in " << serverTotalMs << " ms, latency p50 "
+			<< stats::Percentile(serverLatenciesMs, 0.5) << " ms, p90 " << stats::Percentile(serverLatenciesMs, 0.9) << " ms, p99 "
+			<< stats::Percentile(serverLatenciesMs, 0.99) << " ms, render p50 " << stats.renderP50Ms << " ms, max queue depth " << stats.maxQueueDepth << '\n';
+	}
+
+	// Single-pass rendering against progressive passes of the same total sample count, with and without
+	// a snapshot after every pass, plus the largest difference between the final images.
+	void BenchmarkProgressive(const Camera& camera, const Scene& scene, int imageWidth, int imageHeight, int samplesPerPixel, int maxDepth)
+	{
+		auto elapsedMs = [](auto startTime)
+		{
+			return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(std::chrono::high_resolution_clock::now() - startTime).count();
+		};
+
+		Renderer renderer(imageWidth, imageHeight);
+		std::vector<float> singlePass(static_cast<size_t>(imageWidth) * imageHeight * 3);
+		auto startTime = std::chrono::high_resolution_clock::now();
+		renderer.RenderImage(camera, scene, samplesPerPixel, maxDepth, singlePass);
+		const double singlePassMs = elapsedMs(startTime);
+		std::cout << "Single pass: " << singlePassMs << " ms\n";
+
+		for (int samplesPerPass : { 1, 4, 16 })
+		{
+			for (bool snapshots : { false, true })
+			{
+				AccumulationBuffer accumulation(imageWidth, imageHeight);
+				std::vector<float> snapshot;
+				startTime = std::chrono::high_resolution_clock::now();
+				renderer.RenderProgressive(camera, scene, samplesPerPixel / samplesPerPass, samplesPerPass, maxDepth, accumulation, [&](int)
+					{
+						if (snapshots)
+						{
+							accumulation.Snapshot(snapshot, renderer.ThreadsCount());
+						}
+					});
+				const double progressiveMs = elapsedMs(startTime);
+
+				accumulation.Snapshot(snapshot);
+				float maxDifference = 0.0f;
+				for (size_t i = 0; i < snapshot.size(); i++)
+				{
+					maxDifference = std::max(maxDifference, std::abs(snapshot[i] - singlePass[i]));
+				}
+				std::cout << samplesPerPass << " spp passes" << (snapshots ? " with snapshots" : "") << ": " << progressiveMs << " ms ("
+					<< (progressiveMs / singlePassMs - 1.0) * 100.0 << "% overhead), max difference: " << maxDifference << '\n';
+			}
+		}
+	}
+
+	// Deadline accuracy of time-budgeted rendering: overshoot against the longest tile and the samples reached.
+	void BenchmarkTimeBudget(const Camera& camera, const Scene& scene, int imageWidth, int imageHeight, int maxDepth, const std::string& outputPrefix)
+	{
+		Renderer renderer(imageWidth, imageHeight);
+		for (double timeBudgetMs : { 100.0, 500.0, 2000.0, 8000.0 })
+		{
+			AccumulationBuffer accumulation(imageWidth, imageHeight);
+			auto report = renderer.RenderForTime(camera, scene, timeBudgetMs, maxDepth, accumulation);
+			std::cout << "Budget: " << timeBudgetMs << " ms, render time: " << report.renderTimeMs << " ms, overshoot: " << report.overshootMs
+				<< " ms, longest tile: " << report.maxTileTimeMs << " ms, passes: " << report.passesCount << ", spp min/mean/max: "
+				<< report.minSamplesPerPixel << "/" << report.meanSamplesPerPixel << "/" << report.maxSamplesPerPixel << '\n';
+
+			std::vector<float> imageBuffer;
+			accumulation.Snapshot(imageBuffer);
+			SaveImage(outputPrefix + std::to_string(static_cast<int>(timeBudgetMs)) + "ms.png", imageBuffer, imageWidth, imageHeight);
+		}
+	}
+
+	// Mean linear radiance of every pixel, rows from the top of the image.
+	std::vector<Color> RenderLinear(const Renderer& renderer, const Camera& camera, const Scene& scene, int imageWidth, int imageHeight, int samplesPerPixel, int maxDepth)
+	{
+		std::vector<Color> image(static_cast<size_t>(imageWidth) * imageHeight);
+		parallel::For(0, imageHeight, renderer.ThreadsCount(), [&](int k)
+			{
+				auto sampler = renderer.CreateSampler(0, samplesPerPixel);
+				for (int i = 0; i < imageWidth; i++)
+				{
+					Color pixelColor(0.0, 0.0, 0.0);
+					for (int sample = 0; sample < samplesPerPixel; sample++)
+					{
+						renderer.StartPixelSample(*sampler, i, k, sample);
+						pixelColor += renderer.SamplePixel(camera, scene, i, imageHeight - 1 - k, maxDepth, *sampler);
+					}
+					image[static_cast<size_t>(k) * imageWidth + i] = pixelColor / samplesPerPixel;
+				}
+			});
+		return image;
+	}
+
+	double RootMeanSquaredError(const std::vector<Color>& image, const std::vector<Color>& reference)
+	{
+		double squaredErrorSum = 0.0;
+		for (size_t i = 0; i < image.size(); i++)
+		{
+			Color difference = image[i] - reference[i];
+			squaredErrorSum += (difference.R() * difference.R() + difference.G() * difference.G() + difference.B() * difference.B()) / 3.0;
+		}
+		return std::sqrt(squaredErrorSum / image.size());
+	}
+
+	// Equal-time RMSE of every sampler against an independent-sampler reference. The sample count is the
+	// number of independent samples that fit into the time budget.
+	void BenchmarkSamplers(const Camera& camera, const Scene& scene, int imageWidth, int imageHeight, int maxDepth, double timeBudgetMs, int referenceSamplesPerPixel)
+	{
+		auto elapsedMs = [](auto startTime)
+		{
+			return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(std::chrono::high_resolution_clock::now() - startTime).count();
+		};
+
+		Renderer renderer(imageWidth, imageHeight);
+		renderer.SetSeed(0x5eed);
+		auto reference = RenderLinear(renderer, camera, scene, imageWidth, imageHeight, referenceSamplesPerPixel, maxDepth);
+		renderer.SetSeed(0);
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+		RenderLinear(renderer, camera, scene, imageWidth, imageHeight, 1, maxDepth);
+		int samplesPerPixel = std::max(1, static_cast<int>(timeBudgetMs / std::max(elapsedMs(startTime), 1e-3)));
+
+		const std::pair<std::shared_ptr<Sampler>, std::string> samplers[] = {
+			{ std::make_shared<IndependentSampler>(), "independent" },
+			{ std::make_shared<StratifiedSampler>(), "stratified" },
+			{ std::make_shared<HaltonSampler>(), "halton" },
+			{ std::make_shared<SobolSampler>(), "sobol" } };
+		for (const auto& [sampler, name] : samplers)
+		{
+			renderer.SetSampler(sampler);
+			startTime = std::chrono::high_resolution_clock::now();
+			auto image = RenderLinear(renderer, camera, scene, imageWidth, imageHeight, samplesPerPixel, maxDepth);
+			std::cout << "Sampler " << name << ": " << samplesPerPixel << " spp in " << elapsedMs(startTime)
+				<< " ms, RMSE: " << RootMeanSquaredError(image, reference) << '\n';
+		}
+	}
+
+	double RootMeanSquaredError(const std::vector<float>& imageBuffer, const std::vector<float>& referenceBuffer)
+	{
+		double squaredErrorSum = 0.0;
+		for (size_t i = 0; i < imageBuffer.size(); i++)
+		{
+			double difference = static_cast<double>(imageBuffer[i]) - referenceBuffer[i];
+			squaredErrorSum += difference * difference;
+		}
+		return std::sqrt(squaredErrorSum / imageBuffer.size());
+	}
+
+	// 3x3 binomial blur of an RGB buffer, keeps only the low frequencies that a denoiser cannot tell from signal.
+	std::vector<float> LowPass(const std::vector<float>& buffer, int imageWidth, int imageHeight)
+	{
+		static const float weights[3] = { 0.25f, 0.5f, 0.25f };
+		std::vector<float> result(buffer.size(), 0.0f);
+		for (int y = 0; y < imageHeight; y++)
+		{
+			for (int x = 0; x < imageWidth; x++)
+			{
+				for (int dy = -1; dy <= 1; dy++)
+				{
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						int sx = std::clamp(x + dx, 0, imageWidth - 1);
+						int sy = std::clamp(y + dy, 0, imageHeight - 1);
+						float weight = weights[dx + 1] * weights[dy + 1];
+						for (int c = 0; c < 3; c++)
+						{
+							result[(static_cast<size_t>(y) * imageWidth + x) * 3 + c] += weight * buffer[(static_cast<size_t>(sy) * imageWidth + sx) * 3 + c];
+						}
+					}
+				}
+			}
+		}
+		return result;
+	}
+
+	// Error at the low sample counts used for previews, before and after denoising. Screen-space blue noise
+	// does not lower the per-pixel error, it moves it to high frequencies where the denoiser removes it.
+	void BenchmarkBlueNoise(const Camera& camera, const Scene& scene, int imageWidth, int imageHeight, int maxDepth, int referenceSamplesPerPixel)
+	{
+		const size_t bufferSize = static_cast<size_t>(imageWidth) * imageHeight * 3;
+		std::vector<float> reference(bufferSize), image(bufferSize), albedo(bufferSize), normal(bufferSize), denoised(bufferSize);
+
+		Renderer renderer(imageWidth, imageHeight);
+		renderer.SetSeed(0x5eed);
+		renderer.RenderImage(camera, scene, referenceSamplesPerPixel, maxDepth, reference);
+		renderer.SetSeed(0);
+		const auto referenceLowPass = LowPass(reference, imageWidth, imageHeight);
+
+		const std::pair<std::shared_ptr<Sampler>, std::string> samplers[] = {
+			{ std::make_shared<IndependentSampler>(), "independent" },
+			{ std::make_shared<SobolSampler>(), "sobol" },
+			{ std::make_shared<ZSobolSampler>(imageWidth, imageHeight), "zsobol" } };
+		for (int samplesPerPixel : { 4, 8 })
+		{
+			for (const auto& [sampler, name] : samplers)
+			{
+				renderer.SetSampler(sampler);
+				renderer.RenderImage(camera, scene, samplesPerPixel, maxDepth, image);
+				renderer.RenderAlbedo(camera, scene, samplesPerPixel, albedo);
+				renderer.RenderNormal(camera, scene, samplesPerPixel, normal);
+				renderer.DenoiseImage(image, albedo, normal, denoised);
+				std::cout << "Sampler " << name << ", " << samplesPerPixel << " spp, RMSE: " << RootMeanSquaredError(image, reference)
+					<< ", low-pass RMSE: " << RootMeanSquaredError(LowPass(image, imageWidth, imageHeight), referenceLowPass)
+					<< ", denoised RMSE: " << RootMeanSquaredError(denoised, reference) << '\n';
+			}
+		}
+	}
+
+	// Uniform floats per nanosecond from the scalar generator and from 8 and 16 lane batches.
+	// The batches are first checked against the scalar stream, value for value.
+	void BenchmarkRandom()
+	{
+		constexpr size_t bufferSize = 4096;
+		constexpr int repetitions = 50000;
+		std::vector<float> expected(bufferSize), values(bufferSize);
+		double checksum = 0.0;
+
+		auto measure = [&](const std::string& name, auto fill)
+		{
+			const auto startTime = std::chrono::high_resolution_clock::now();
+			for (int repetition = 0; repetition < repetitions; repetition++)
+			{
+				fill(values.data(), bufferSize);
+				checksum += values[repetition % bufferSize];
+			}
+			const auto nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - startTime).count();
+			std::cout << name << ": " << static_cast<double>(bufferSize) * repetitions / nanoseconds << " numbers/ns\n";
+		};
+
+		auto verify = [&](const std::string& name, auto batch)
+		{
+			Random scalar(42, 7);
+			for (auto& value : expected)
+			{
+				value = scalar.NextFloat();
+			}
+			// Odd chunk sizes cover the partial batch path.
+			for (size_t i = 0; i < bufferSize;)
+			{
+				size_t count = std::min<size_t>(bufferSize - i, 1 + (i % 37));
+				batch.Fill(values.data() + i, count);
+				i += count;
+			}
+			bool identical = values == expected && batch.Scalar().NextFloat() == scalar.NextFloat();
+			std::cout << name << (identical ? " matches" : " DOES NOT match") << " the scalar stream\n";
+		};
+
+		verify("8 lanes", RandomBatch<8>(Random(42, 7)));
+		verify("16 lanes", RandomBatch<16>(Random(42, 7)));
+
+		Random scalar(42, 7);
+		measure("Scalar", [&](float* out, size_t count)
+			{
+				for (size_t i = 0; i < count; i++)
+				{
+					out[i] = scalar.NextFloat();
+				}
+			});
+		RandomBatch<8> batch8(Random(42, 7));
+		measure("8 lanes", [&](float* out, size_t count) { batch8.Fill(out, count); });
+		RandomBatch<16> batch16(Random(42, 7));
+		measure("16 lanes", [&](float* out, size_t count) { batch16.Fill(out, count); });
+		std::cout << "Checksum: " << checksum << '\n';
+	}
+
+	// Adaptive sampling against uniform sampling with the same total number of samples. Writes the adaptive
+	// image and its sample-count heatmap.
+	void BenchmarkAdaptiveSampling(const Camera& camera, const Scene& scene, int imageWidth, int imageHeight, int maxDepth, int referenceSamplesPerPixel, const std::string& outputPrefix)
+	{
+		Renderer renderer(imageWidth, imageHeight);
+		renderer.SetSeed(0x5eed);
+		auto reference = RenderLinear(renderer, camera, scene, imageWidth, imageHeight, referenceSamplesPerPixel, maxDepth);
+		renderer.SetSeed(0);
+
+		auto linearImage = [&](const AccumulationBuffer& accumulation)
+		{
+			std::vector<Color> image(static_cast<size_t>(imageWidth) * imageHeight);
+			for (int k = 0; k < imageHeight; k++)
+			{
+				for (int i = 0; i < imageWidth; i++)
+				{
+					image[static_cast<size_t>(k) * imageWidth + i] = accumulation.Mean(i, k);
+				}
+			}
+			return image;
+		};
+
+		AdaptiveSettings settings;
+		AccumulationBuffer adaptive(imageWidth, imageHeight);
+		auto report = renderer.RenderAdaptive(camera, scene, maxDepth, adaptive, settings);
+		std::cout << "Adaptive: " << report.passesCount << " passes, " << report.samplesCount << " samples of " << report.uniformSamplesCount
+			<< " (" << report.savedSamplesFraction * 100.0 << "% saved), " << report.renderTimeMs << " ms, RMSE: "
+			<< RootMeanSquaredError(linearImage(adaptive), reference) << '\n';
+
+		const int uniformSamplesPerPixel = std::max(1, static_cast<int>(report.samplesCount / (static_cast<uint64_t>(imageWidth) * imageHeight)));
+		AccumulationBuffer uniform(imageWidth, imageHeight);
+		const auto startTime = std::chrono::high_resolution_clock::now();
+		renderer.RenderPass(camera, scene, uniformSamplesPerPixel, maxDepth, uniform);
+		std::cout << "Uniform: " << uniformSamplesPerPixel << " spp, " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count()
+			<< " ms, RMSE: " << RootMeanSquaredError(linearImage(uniform), reference) << '\n';
+
+		std::vector<float> imageBuffer;
+		adaptive.Snapshot(imageBuffer);
+		SaveImage(outputPrefix + "image.png", imageBuffer, imageWidth, imageHeight);
+		adaptive.SampleCountHeatmap(imageBuffer);
+		SaveImage(outputPrefix + "samples.png", imageBuffer, imageWidth, imageHeight);
+	}
+}
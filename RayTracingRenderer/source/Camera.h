@@ -1,5 +1,7 @@
 #pragma once
 
+#include "Ray.h"
+#include "Sampler.h"
 #include "Vector3.h"
 #include "Utility.h"
 
@@ -27,9 +29,9 @@ namespace rtr
             lensRadius = aperture / 2;
         }
 
-        Ray GetRay(double u, double v) const
+        Ray GetRay(double u, double v, Sampler& sampler) const
         {
-            Vector3 offsetDisk = lensRadius * util::RandomVectorInUnitDisk();
+            Vector3 offsetDisk = lensRadius * util::RandomVectorInUnitDisk(sampler);
             Vector3 offsetVector = cameraX * offsetDisk.X() + cameraY * offsetDisk.Y();
 
             return Ray(origin + offsetVector, lowerLeftOffset + u * horizontalVector + v * verticalVector - offsetVector);
@@ -50,4 +52,21 @@ namespace rtr
         Vector3 cameraZ;
         double lensRadius;
     };
+
+    // Parameters of the Camera constructor, so a camera can be described, sent and rebuilt elsewhere.
+    struct CameraSettings
+    {
+        Point3 position;
+        Point3 lookAt;
+        Vector3 viewUp;
+        double vFov = 20.0;
+        double aspectRatio = 16.0 / 9.0;
+        double aperture = 0.0;
+        double focusDistance = 1.0;
+
+        Camera Create() const
+        {
+            return Camera(position, lookAt, viewUp, vFov, aspectRatio, aperture, focusDistance);
+        }
+    };
 }
@@ -0,0 +1,260 @@
+#pragma once
+
+#include "AccumulationBuffer.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace rtr
+{
+	// Everything besides the buffer that decides which samples a checkpointed render adds. Sample values are
+	// a function of (seed, sample offset, sampler, pixel, sample index) only, so together with the per-pixel
+	// counts in the buffer this is the complete RNG and sampler state.
+	struct CheckpointState
+	{
+		uint64_t seed = 0;
+		int32_t sampleOffset = 0;
+		int32_t samplesPerPixel = 0; // Target of the render.
+		int32_t samplesPerPass = 0;
+		std::string sampler;         // Sampler::Name of the sampler prototype.
+
+		bool operator==(const CheckpointState& other) const
+		{
+			return seed == other.seed && sampleOffset == other.sampleOffset && samplesPerPixel == other.samplesPerPixel
+				&& samplesPerPass == other.samplesPerPass && sampler == other.sampler;
+		}
+	};
+
+	namespace detail
+	{
+		inline constexpr uint32_t checkpointMagic = 0x31435452; // "RTC1"
+
+		// Flushes the file's data to the device, so a rename after it never exposes a partly written file.
+		inline bool SyncFile(const std::string& fileName)
+		{
+#if defined(_WIN32)
+			HANDLE file = CreateFileA(fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+			const bool synced = FlushFileBuffers(file) != 0;
+			CloseHandle(file);
+			return synced;
+#elif defined(__unix__) || defined(__APPLE__)
+			const int file = open(fileName.c_str(), O_RDONLY);
+			if (file < 0)
+			{
+				return false;
+			}
+			const bool synced = fsync(file) == 0;
+			close(file);
+			return synced;
+#else
+			return true;
+#endif
+		}
+	}
+
+	// Writes the checkpoint next to fileName, syncs it and renames it over fileName, so after a crash the file
+	// holds either the previous or the new checkpoint. A checksum guards against anything else.
+	inline bool SaveCheckpoint(const std::string& fileName, const AccumulationBuffer& accumulation, const CheckpointState& state)
+	{
+		const std::string temporaryFileName = fileName + ".tmp";
+		{
+			std::ofstream file(temporaryFileName, std::ios::binary | std::ios::trunc);
+			if (!file)
+			{
+				return false;
+			}
+
+			const int32_t width = accumulation.Width();
+			const int32_t height = accumulation.Height();
+			const uint32_t samplerLength = static_cast<uint32_t>(state.sampler.size());
+			const uint64_t checksum = accumulation.Checksum();
+			file.write(reinterpret_cast<const char*>(&detail::checkpointMagic), sizeof(detail::checkpointMagic));
+			file.write(reinterpret_cast<const char*>(&width), sizeof(width));
+			file.write(reinterpret_cast<const char*>(&height), sizeof(height));
+			file.write(reinterpret_cast<const char*>(&state.seed), sizeof(state.seed));
+			file.write(reinterpret_cast<const char*>(&state.sampleOffset), sizeof(state.sampleOffset));
+			file.write(reinterpret_cast<const char*>(&state.samplesPerPixel), sizeof(state.samplesPerPixel));
+			file.write(reinterpret_cast<const char*>(&state.samplesPerPass), sizeof(state.samplesPerPass));
+			file.write(reinterpret_cast<const char*>(&samplerLength), sizeof(samplerLength));
+			file.write(state.sampler.data(), samplerLength);
+			file.write(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+			accumulation.Write(file);
+			if (!file.flush())
+			{
+				return false;
+			}
+		}
+
+		std::error_code error;
+		if (!detail::SyncFile(temporaryFileName))
+		{
+			std::filesystem::remove(temporaryFileName, error);
+			return false;
+		}
+		std::filesystem::rename(temporaryFileName, fileName, error);
+		return !error;
+	}
+
+	// Loads a checkpoint of an image of the buffer's size. The buffer is only changed when the whole file is valid.
+	inline bool LoadCheckpoint(const std::string& fileName, AccumulationBuffer& accumulation, CheckpointState& state)
+	{
+		std::ifstream file(fileName, std::ios::binary);
+		if (!file)
+		{
+			return false;
+		}
+
+		uint32_t magic = 0, samplerLength = 0;
+		int32_t width = 0, height = 0;
+		uint64_t checksum = 0;
+		CheckpointState loadedState;
+		file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+		file.read(reinterpret_cast<char*>(&width), sizeof(width));
+		file.read(reinterpret_cast<char*>(&height), sizeof(height));
+		file.read(reinterpret_cast<char*>(&loadedState.seed), sizeof(loadedState.seed));
+		file.read(reinterpret_cast<char*>(&loadedState.sampleOffset), sizeof(loadedState.sampleOffset));
+		file.read(reinterpret_cast<char*>(&loadedState.samplesPerPixel), sizeof(loadedState.samplesPerPixel));
+		file.read(reinterpret_cast<char*>(&loadedState.samplesPerPass), sizeof(loadedState.samplesPerPass));
+		file.read(reinterpret_cast<char*>(&samplerLength), sizeof(samplerLength));
+		if (!file || magic != detail::checkpointMagic || width != accumulation.Width() || height != accumulation.Height() || samplerLength > 4096)
+		{
+			return false;
+		}
+		loadedState.sampler.resize(samplerLength);
+		file.read(loadedState.sampler.data(), samplerLength);
+		file.read(reinterpret_cast<char*>(&checksum), sizeof(checksum));
+
+		AccumulationBuffer loaded(width, height);
+		if (!loaded.Read(file) || loaded.Checksum() != checksum)
+		{
+			return false;
+		}
+		accumulation = std::move(loaded);
+		state = loadedState;
+		return true;
+	}
+
+	// Saves checkpoints on its own thread, so rendering only pays for copying the buffer. When a new copy
+	// arrives before the previous one was written, only the newest is kept.
+	class CheckpointWriter
+	{
+	public:
+		explicit CheckpointWriter(std::string fileName) : fileName(std::move(fileName))
+		{
+			thread = std::thread([this]() { WriterLoop(); });
+		}
+
+		CheckpointWriter(const CheckpointWriter&) = delete;
+		CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+		~CheckpointWriter()
+		{
+			Finish();
+		}
+
+		// Writes whatever is still pending and stops the writer thread.
+		void Finish()
+		{
+			if (!thread.joinable())
+			{
+				return;
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_one();
+			thread.join();
+		}
+
+		void Submit(const AccumulationBuffer& accumulation, const CheckpointState& state)
+		{
+			auto copy = std::make_unique<AccumulationBuffer>(accumulation);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending = std::move(copy);
+				pendingState = state;
+			}
+			wake.notify_one();
+		}
+
+		int WrittenCount() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return writtenCount;
+		}
+
+		int FailedCount() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return failedCount;
+		}
+
+		// Time spent writing and syncing, summed over all checkpoints.
+		double WriteTimeMs() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return writeTimeMs;
+		}
+
+	private:
+		void WriterLoop()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (true)
+			{
+				wake.wait(lock, [this]() { return stopping || pending != nullptr; });
+				if (pending == nullptr)
+				{
+					return;
+				}
+
+				auto accumulation = std::move(pending);
+				auto state = pendingState;
+				lock.unlock();
+				const auto startTime = std::chrono::steady_clock::now();
+				const bool saved = SaveCheckpoint(fileName, *accumulation, state);
+				const double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+				lock.lock();
+				(saved ? writtenCount : failedCount)++;
+				writeTimeMs += elapsedMs;
+			}
+		}
+
+		const std::string fileName;
+		mutable std::mutex mutex;
+		std::condition_variable wake;
+		std::unique_ptr<AccumulationBuffer> pending;
+		CheckpointState pendingState;
+		int writtenCount = 0;
+		int failedCount = 0;
+		double writeTimeMs = 0.0;
+		bool stopping = false;
+		std::thread thread;
+	};
+}
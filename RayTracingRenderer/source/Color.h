@@ -3,6 +3,7 @@
 #include "Constants.h"
 
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 
 namespace rtr
@@ -69,6 +70,16 @@ namespace rtr
 			return *this *= 1 / d;
 		}
 
+		double Luminance() const
+		{
+			return 0.2126 * r + 0.7152 * g + 0.0722 * b;
+		}
+
+		bool IsBlack() const
+		{
+			return r == 0.0 && g == 0.0 && b == 0.0;
+		}
+
 		void Normalize(int samplesCount)
 		{
 			double scale = 1.0 / samplesCount;
@@ -7,6 +7,7 @@ namespace rtr::consts
 	const double infinity = std::numeric_limits<double>::infinity();
 	const double pi = 3.1415926535897932385;
 	const double eps = 1e-8;
+	const double oneMinusEpsilon = 0x1.fffffffffffffp-1;
 	const int channels = 3;
 	const double doubleToByteRatio = 255.999;
 }
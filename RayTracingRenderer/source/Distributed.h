@@ -0,0 +1,388 @@
+#pragma once
+
+#include "AccumulationBuffer.h"
+#include "Camera.h"
+#include "Network.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "TileScheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rtr
+{
+	// Everything a worker needs to render any part of a frame. Scenes are built by name on every worker, so
+	// all of them must use the same scene factory.
+	struct DistributedJob
+	{
+		std::string scene;
+		CameraSettings camera;
+		int32_t imageWidth = 0;
+		int32_t imageHeight = 0;
+		int32_t samplesPerPixel = 0;
+		int32_t maxDepth = 0;
+		uint64_t seed = 0;
+		int32_t tileSize = 64;
+		int32_t samplesPerWorkItem = 0; // Splits the samples of every tile into ranges of this size; 0 keeps them whole.
+	};
+
+	struct DistributedReport
+	{
+		bool completed = false;         // Every work item came back; false when the coordinator gave up waiting for workers.
+		int workersCount = 0;           // Workers that received the job.
+		int workItemsCount = 0;
+		int requeuedWorkItemsCount = 0; // Handed out again after their worker failed.
+		int failedWorkersCount = 0;
+		double renderTimeMs = 0.0;
+	};
+
+	struct WorkerReport
+	{
+		int workItemsCount = 0;
+		bool completed = false;         // The coordinator finished the job; false after a lost connection.
+		double renderTimeMs = 0.0;
+	};
+
+	// Builds the scene of the given name; throws for names it does not know.
+	using SceneFactory = std::function<Scene(const std::string& name)>;
+
+	namespace detail
+	{
+		enum MessageType : uint32_t
+		{
+			jobMessage = 1,  // Coordinator to worker: DistributedJob.
+			workMessage,     // Coordinator to worker: index, tile, sample range.
+			resultMessage,   // Worker to coordinator: index, WriteRegion of the tile.
+			doneMessage      // Coordinator to worker: no more work.
+		};
+
+		// Largest frame a worker accepts, so a malformed job cannot make it allocate without bound.
+		inline constexpr int64_t maxJobPixels = int64_t(1) << 26;
+
+		struct WorkItem
+		{
+			Tile tile;
+			int32_t sampleBegin = 0;
+			int32_t sampleEnd = 0;
+		};
+
+		// Largest job message a worker accepts; the scene name is its only variable part.
+		inline constexpr uint64_t maxJobMessageBytes = 4096;
+
+		// Work messages: index, tile, sample range. Done messages are empty.
+		inline constexpr uint64_t workMessageBytes = sizeof(uint32_t) + sizeof(Tile) + 2 * sizeof(int32_t);
+
+		inline std::vector<char> JobPayload(const DistributedJob& job)
+		{
+			net::MessageWriter writer;
+			writer.PutString(job.scene);
+			writer.Put(job.camera.position).Put(job.camera.lookAt).Put(job.camera.viewUp);
+			writer.Put(job.camera.vFov).Put(job.camera.aspectRatio).Put(job.camera.aperture).Put(job.camera.focusDistance);
+			writer.Put(job.imageWidth).Put(job.imageHeight).Put(job.samplesPerPixel).Put(job.maxDepth);
+			writer.Put(job.seed).Put(job.tileSize).Put(job.samplesPerWorkItem);
+			return writer.Payload();
+		}
+
+		inline bool ReadJob(const std::vector<char>& payload, DistributedJob& job)
+		{
+			net::MessageReader reader(payload);
+			return reader.GetString(job.scene)
+				&& reader.Get(job.camera.position) && reader.Get(job.camera.lookAt) && reader.Get(job.camera.viewUp)
+				&& reader.Get(job.camera.vFov) && reader.Get(job.camera.aspectRatio) && reader.Get(job.camera.aperture) && reader.Get(job.camera.focusDistance)
+				&& reader.Get(job.imageWidth) && reader.Get(job.imageHeight) && reader.Get(job.samplesPerPixel) && reader.Get(job.maxDepth)
+				&& reader.Get(job.seed) && reader.Get(job.tileSize) && reader.Get(job.samplesPerWorkItem)
+				&& job.imageWidth > 0 && job.imageHeight > 0 && static_cast<int64_t>(job.imageWidth) * job.imageHeight <= maxJobPixels
+				&& job.samplesPerPixel > 0 && job.maxDepth >= 0 && job.tileSize > 0;
+		}
+
+		// Work items come off the network, so they are checked before anything is rendered or written for them.
+		inline bool IsValidWorkItem(const WorkItem& item, const DistributedJob& job)
+		{
+			const Tile& tile = item.tile;
+			return tile.x0 >= 0 && tile.y0 >= 0 && tile.x0 < tile.x1 && tile.y0 < tile.y1 && tile.x1 <= job.imageWidth && tile.y1 <= job.imageHeight
+				&& item.sampleBegin >= 0 && item.sampleBegin < item.sampleEnd && item.sampleEnd <= job.samplesPerPixel;
+		}
+
+		// The scene of a received job, or null when the factory does not know its name.
+		inline std::unique_ptr<Scene> BuildScene(const SceneFactory& sceneFactory, const std::string& name)
+		{
+			try
+			{
+				return std::make_unique<Scene>(sceneFactory(name));
+			}
+			catch (const std::exception&)
+			{
+				return nullptr;
+			}
+		}
+	}
+
+	// Hands out tiles (or sample ranges of tiles) of a frame to worker processes connecting over TCP and adds
+	// their linear sums into one accumulation buffer. Workers may join at any time. A work item whose worker
+	// disconnects or does not answer within the timeout goes back to the front of the queue, and the worker is
+	// dropped. Sample values depend only on the seed, pixel and sample index, so the assembled buffer equals a
+	// local RenderToSampleCount regardless of which worker rendered what, bit for bit when the samples of a
+	// tile are not split. With no worker connected for idleTimeoutSeconds the render is given up.
+	class Coordinator
+	{
+	public:
+		// Workers on other machines need ListenAddress::AnyInterface.
+		explicit Coordinator(int port = 0, net::ListenAddress listenAddress = net::ListenAddress::Loopback, double workTimeoutSeconds = 300.0,
+			double idleTimeoutSeconds = 300.0)
+			: listener(net::Socket::Listen(port, listenAddress)), workTimeoutSeconds(workTimeoutSeconds), idleTimeoutSeconds(idleTimeoutSeconds)
+		{
+		}
+
+		Coordinator(const Coordinator&) = delete;
+		Coordinator& operator=(const Coordinator&) = delete;
+
+		bool IsListening() const
+		{
+			return listener.IsValid();
+		}
+
+		int Port() const
+		{
+			return listener.LocalPort();
+		}
+
+		// Blocks until every work item came back, or until no worker was connected for the idle timeout, e.g.
+		// because none ever connected or all of them failed; see DistributedReport::completed. The buffer must
+		// have the job's size and is added to; after giving up it holds the work items that came back.
+		DistributedReport Render(const DistributedJob& job, AccumulationBuffer& accumulation)
+		{
+			const auto startTime = std::chrono::steady_clock::now();
+			const int samplesPerWorkItem = job.samplesPerWorkItem > 0 ? job.samplesPerWorkItem : job.samplesPerPixel;
+			std::vector<detail::WorkItem> workItems;
+			for (const auto& tile : SplitIntoTiles(job.imageWidth, job.imageHeight, job.tileSize))
+			{
+				for (int sampleBegin = 0; sampleBegin < job.samplesPerPixel; sampleBegin += samplesPerWorkItem)
+				{
+					workItems.push_back({ tile, sampleBegin, std::min(sampleBegin + samplesPerWorkItem, job.samplesPerPixel) });
+				}
+			}
+
+			State state;
+			state.report.workItemsCount = static_cast<int>(workItems.size());
+			for (size_t index = 0; index < workItems.size(); index++)
+			{
+				state.pending.push_back(static_cast<uint32_t>(index));
+			}
+			const auto jobPayload = detail::JobPayload(job);
+
+			std::vector<std::thread> connections;
+			auto finished = [&]() { return state.completedCount == workItems.size(); };
+			{
+				auto lastConnectedTime = std::chrono::steady_clock::now();
+				std::unique_lock<std::mutex> lock(state.mutex);
+				while (!finished())
+				{
+					if (state.connectedCount > 0)
+					{
+						lastConnectedTime = std::chrono::steady_clock::now();
+					}
+					else if (std::chrono::duration<double>(std::chrono::steady_clock::now() - lastConnectedTime).count() > idleTimeoutSeconds)
+					{
+						state.abandoned = true;
+						break;
+					}
+					lock.unlock();
+					if (listener.WaitReadable(0.1))
+					{
+						auto worker = std::make_shared<net::Socket>(listener.Accept());
+						if (worker->IsValid())
+						{
+							lock.lock();
+							state.connectedCount++;
+							lock.unlock();
+							connections.emplace_back([&, worker]()
+								{
+									ServeWorker(*worker, jobPayload, workItems, accumulation, state);
+									std::lock_guard<std::mutex> connectionLock(state.mutex);
+									state.connectedCount--;
+								});
+						}
+					}
+					lock.lock();
+				}
+				state.report.completed = finished();
+			}
+			state.changed.notify_all();
+			for (auto& connection : connections)
+			{
+				connection.join();
+			}
+
+			state.report.renderTimeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+			return state.report;
+		}
+
+	private:
+		struct State
+		{
+			std::mutex mutex;
+			std::condition_variable changed;
+			std::deque<uint32_t> pending;
+			size_t completedCount = 0;
+			int connectedCount = 0; // Workers being served.
+			bool abandoned = false;
+			DistributedReport report;
+		};
+
+		void ServeWorker(net::Socket& worker, const std::vector<char>& jobPayload, const std::vector<detail::WorkItem>& workItems,
+			AccumulationBuffer& accumulation, State& state) const
+		{
+			if (!net::SendMessage(worker, detail::jobMessage, jobPayload))
+			{
+				return;
+			}
+			worker.SetReceiveTimeout(workTimeoutSeconds);
+			{
+				std::lock_guard<std::mutex> lock(state.mutex);
+				state.report.workersCount++;
+			}
+
+			std::vector<char> payload;
+			while (true)
+			{
+				uint32_t index = 0;
+				{
+					std::unique_lock<std::mutex> lock(state.mutex);
+					state.changed.wait(lock, [&]() { return !state.pending.empty() || state.completedCount == workItems.size() || state.abandoned; });
+					if (state.pending.empty() || state.abandoned)
+					{
+						break;
+					}
+					index = state.pending.front();
+					state.pending.pop_front();
+				}
+
+				const auto& item = workItems[index];
+				net::MessageWriter work;
+				work.Put(index).Put(item.tile).Put(item.sampleBegin).Put(item.sampleEnd);
+				uint32_t type = 0, resultIndex = 0;
+				const uint64_t resultBytes = sizeof(resultIndex) + AccumulationBuffer::StorageBytes(item.tile.x1 - item.tile.x0, item.tile.y1 - item.tile.y0);
+				bool delivered = net::SendMessage(worker, detail::workMessage, work.Payload()) && net::ReceiveMessage(worker, type, payload, resultBytes);
+				delivered = delivered && type == detail::resultMessage && payload.size() >= sizeof(resultIndex);
+				if (delivered)
+				{
+					std::memcpy(&resultIndex, payload.data(), sizeof(resultIndex));
+					delivered = resultIndex == index;
+				}
+
+				std::lock_guard<std::mutex> lock(state.mutex);
+				if (delivered)
+				{
+					std::istringstream region(std::string(payload.begin() + sizeof(resultIndex), payload.end()));
+					delivered = accumulation.AddRegion(region, item.tile.x0, item.tile.y0, item.tile.x1, item.tile.y1);
+				}
+				if (!delivered)
+				{
+					state.pending.push_front(index);
+					state.report.requeuedWorkItemsCount++;
+					state.report.failedWorkersCount++;
+					state.changed.notify_all();
+					return;
+				}
+				state.completedCount++;
+				state.changed.notify_all();
+			}
+			net::SendMessage(worker, detail::doneMessage, {});
+		}
+
+		net::Socket listener;
+		double workTimeoutSeconds;
+		double idleTimeoutSeconds;
+	};
+
+	// Connects to a coordinator, retrying until connectTimeoutSeconds passed, and renders work items until it
+	// is told to stop. Rendering uses threadsCount threads (all hardware threads for 0). Malformed jobs, jobs of
+	// unknown scenes and work items outside the frame or its sample range drop the connection. For testing failure
+	// handling, stopAfterWorkItems > 0 drops the connection on receiving that many-th work item.
+	inline WorkerReport RunWorker(const std::string& host, int port, const SceneFactory& sceneFactory, int threadsCount = 0,
+		double connectTimeoutSeconds = 10.0, int stopAfterWorkItems = 0)
+	{
+		using Clock = std::chrono::steady_clock;
+		WorkerReport report;
+		const auto startTime = Clock::now();
+		net::Socket coordinator = net::Socket::Connect(host, port);
+		while (!coordinator.IsValid() && std::chrono::duration<double>(Clock::now() - startTime).count() < connectTimeoutSeconds)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			coordinator = net::Socket::Connect(host, port);
+		}
+
+		uint32_t type = 0;
+		std::vector<char> payload;
+		DistributedJob job;
+		if (!coordinator.IsValid() || !net::ReceiveMessage(coordinator, type, payload, detail::maxJobMessageBytes) || type != detail::jobMessage || !detail::ReadJob(payload, job))
+		{
+			return report;
+		}
+
+		const auto scene = detail::BuildScene(sceneFactory, job.scene);
+		if (scene == nullptr)
+		{
+			return report;
+		}
+		const Camera camera = job.camera.Create();
+		Renderer renderer(job.imageWidth, job.imageHeight);
+		renderer.SetSeed(job.seed);
+		renderer.SetThreadsCount(threadsCount);
+		renderer.ClearProgressSubscribers();
+		AccumulationBuffer accumulation(job.imageWidth, job.imageHeight);
+
+		const auto renderStartTime = Clock::now();
+		while (net::ReceiveMessage(coordinator, type, payload, detail::workMessageBytes))
+		{
+			if (type == detail::doneMessage)
+			{
+				report.completed = true;
+				break;
+			}
+
+			net::MessageReader reader(payload);
+			uint32_t index = 0;
+			detail::WorkItem item;
+			if (type != detail::workMessage || !reader.Get(index) || !reader.Get(item.tile) || !reader.Get(item.sampleBegin) || !reader.Get(item.sampleEnd)
+				|| !detail::IsValidWorkItem(item, job) || (stopAfterWorkItems > 0 && report.workItemsCount + 1 >= stopAfterWorkItems))
+			{
+				break;
+			}
+
+			const Tile& tile = item.tile;
+			for (int y = tile.y0; y < tile.y1; y++)
+			{
+				accumulation.ClearRow(y, tile.x0, tile.x1);
+			}
+			renderer.SetCropWindow(tile);
+			renderer.SetSampleOffset(item.sampleBegin);
+			renderer.RenderToSampleCount(camera, *scene, item.sampleEnd - item.sampleBegin, job.maxDepth, accumulation);
+
+			std::ostringstream region;
+			region.write(reinterpret_cast<const char*>(&index), sizeof(index));
+			accumulation.WriteRegion(region, tile.x0, tile.y0, tile.x1, tile.y1);
+			const std::string bytes = region.str();
+			if (!net::SendMessage(coordinator, detail::resultMessage, std::vector<char>(bytes.begin(), bytes.end())))
+			{
+				break;
+			}
+			report.workItemsCount++;
+		}
+		report.renderTimeMs = std::chrono::duration<double, std::milli>(Clock::now() - renderStartTime).count();
+		return report;
+	}
+}
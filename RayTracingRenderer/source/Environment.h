@@ -0,0 +1,244 @@
+#pragma once
+
+#include "Color.h"
+#include "Constants.h"
+#include "Image.h"
+#include "Parallel.h"
+#include "Sampling.h"
+#include "Vector3.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace rtr
+{
+	enum class EnvironmentSampling
+	{
+		Uniform,
+		Importance
+	};
+
+	// Equirectangular HDR environment light with y axis up. Importance sampling uses piecewise constant
+	// tables over the texels weighted by luminance * sin(theta): a marginal CDF over rows and a conditional
+	// CDF over columns of every row. Tables are cached next to the source file.
+	class EnvironmentMap
+	{
+	public:
+		EnvironmentMap(const std::string& fileName);
+
+		bool IsValid() const
+		{
+			return !pixels.empty();
+		}
+
+		Color Radiance(const Vector3& direction) const
+		{
+			int column, row;
+			DirectionToTexel(direction, column, row);
+			return Texel(column, row);
+		}
+
+		Vector3 Sample(double u1, double u2, EnvironmentSampling strategy, double& pdf) const;
+
+		double Pdf(const Vector3& direction, EnvironmentSampling strategy) const;
+
+	private:
+		static constexpr uint32_t cacheMagic = 0x31564E45; // "ENV1"
+
+		Color Texel(int column, int row) const
+		{
+			size_t index = (static_cast<size_t>(row) * width + column) * consts::channels;
+			return Color(pixels[index], pixels[index + 1], pixels[index + 2]);
+		}
+
+		double TexelWeight(int column, int row) const
+		{
+			auto sinTheta = std::sin(consts::pi * (row + 0.5) / height);
+			return Texel(column, row).Luminance() * sinTheta;
+		}
+
+		void DirectionToTexel(const Vector3& direction, int& column, int& row) const
+		{
+			auto phi = std::atan2(direction.Z(), direction.X());
+			phi = phi < 0.0 ? phi + 2.0 * consts::pi : phi;
+			auto theta = std::acos(std::clamp(direction.Y(), -1.0, 1.0));
+			column = std::min(static_cast<int>(phi / (2.0 * consts::pi) * width), width - 1);
+			row = std::min(static_cast<int>(theta / consts::pi * height), height - 1);
+		}
+
+		static size_t SampleCdf(const double* cdf, size_t count, double u, double& remapped);
+
+		void BuildDistribution();
+		bool LoadDistribution(const std::string& cacheFileName, uint64_t sourceSize, int64_t sourceTime);
+		void SaveDistribution(const std::string& cacheFileName, uint64_t sourceSize, int64_t sourceTime) const;
+
+		int width = 0;
+		int height = 0;
+		std::vector<float> pixels;
+		std::vector<double> marginalCdf;    // height + 1 entries.
+		std::vector<double> conditionalCdf; // height * (width + 1) entries.
+		double totalWeight = 0.0;
+	};
+
+	EnvironmentMap::EnvironmentMap(const std::string& fileName)
+	{
+		if (!LoadFloatImage(fileName, pixels, width, height))
+		{
+			pixels.clear();
+			return;
+		}
+
+		std::error_code error;
+		auto sourceSize = static_cast<uint64_t>(std::filesystem::file_size(fileName, error));
+		auto sourceTime = static_cast<int64_t>(std::filesystem::last_write_time(fileName, error).time_since_epoch().count());
+		const std::string cacheFileName = fileName + ".envcache";
+
+		if (!LoadDistribution(cacheFileName, sourceSize, sourceTime))
+		{
+			BuildDistribution();
+			SaveDistribution(cacheFileName, sourceSize, sourceTime);
+		}
+	}
+
+	void EnvironmentMap::BuildDistribution()
+	{
+		marginalCdf.assign(static_cast<size_t>(height) + 1, 0.0);
+		conditionalCdf.assign(static_cast<size_t>(height) * (width + 1), 0.0);
+		std::vector<double> rowWeights(height, 0.0);
+
+		// Rows are independent, only the small marginal table is built serially.
+		parallel::For(0, height, [&](int row)
+			{
+				double* cdf = &conditionalCdf[static_cast<size_t>(row) * (width + 1)];
+				for (int column = 0; column < width; column++)
+				{
+					cdf[column + 1] = cdf[column] + TexelWeight(column, row);
+				}
+
+				rowWeights[row] = cdf[width];
+				for (int column = 1; column <= width; column++)
+				{
+					cdf[column] = rowWeights[row] > 0.0 ? cdf[column] / rowWeights[row] : static_cast<double>(column) / width;
+				}
+			});
+
+		for (int row = 0; row < height; row++)
+		{
+			marginalCdf[row + 1] = marginalCdf[row] + rowWeights[row];
+		}
+
+		totalWeight = marginalCdf[height];
+		for (int row = 1; row <= height; row++)
+		{
+			marginalCdf[row] = totalWeight > 0.0 ? marginalCdf[row] / totalWeight : static_cast<double>(row) / height;
+		}
+	}
+
+	bool EnvironmentMap::LoadDistribution(const std::string& cacheFileName, uint64_t sourceSize, int64_t sourceTime)
+	{
+		std::ifstream file(cacheFileName, std::ios::binary);
+		if (!file)
+		{
+			return false;
+		}
+
+		uint32_t magic = 0;
+		int cachedWidth = 0, cachedHeight = 0;
+		uint64_t cachedSize = 0;
+		int64_t cachedTime = 0;
+		file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+		file.read(reinterpret_cast<char*>(&cachedWidth), sizeof(cachedWidth));
+		file.read(reinterpret_cast<char*>(&cachedHeight), sizeof(cachedHeight));
+		file.read(reinterpret_cast<char*>(&cachedSize), sizeof(cachedSize));
+		file.read(reinterpret_cast<char*>(&cachedTime), sizeof(cachedTime));
+		if (!file || magic != cacheMagic || cachedWidth != width || cachedHeight != height || cachedSize != sourceSize || cachedTime != sourceTime)
+		{
+			return false;
+		}
+
+		marginalCdf.resize(static_cast<size_t>(height) + 1);
+		conditionalCdf.resize(static_cast<size_t>(height) * (width + 1));
+		file.read(reinterpret_cast<char*>(&totalWeight), sizeof(totalWeight));
+		file.read(reinterpret_cast<char*>(marginalCdf.data()), marginalCdf.size() * sizeof(double));
+		file.read(reinterpret_cast<char*>(conditionalCdf.data()), conditionalCdf.size() * sizeof(double));
+		return static_cast<bool>(file);
+	}
+
+	void EnvironmentMap::SaveDistribution(const std::string& cacheFileName, uint64_t sourceSize, int64_t sourceTime) const
+	{
+		std::ofstream file(cacheFileName, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			return;
+		}
+
+		file.write(reinterpret_cast<const char*>(&cacheMagic), sizeof(cacheMagic));
+		file.write(reinterpret_cast<const char*>(&width), sizeof(width));
+		file.write(reinterpret_cast<const char*>(&height), sizeof(height));
+		file.write(reinterpret_cast<const char*>(&sourceSize), sizeof(sourceSize));
+		file.write(reinterpret_cast<const char*>(&sourceTime), sizeof(sourceTime));
+		file.write(reinterpret_cast<const char*>(&totalWeight), sizeof(totalWeight));
+		file.write(reinterpret_cast<const char*>(marginalCdf.data()), marginalCdf.size() * sizeof(double));
+		file.write(reinterpret_cast<const char*>(conditionalCdf.data()), conditionalCdf.size() * sizeof(double));
+	}
+
+	size_t EnvironmentMap::SampleCdf(const double* cdf, size_t count, double u, double& remapped)
+	{
+		// Last entry with cdf <= u, empty buckets are never selected.
+		size_t index = std::upper_bound(cdf, cdf + count + 1, u) - cdf;
+		index = std::clamp(index, size_t(1), count) - 1;
+		auto bucketWidth = cdf[index + 1] - cdf[index];
+		remapped = bucketWidth > 0.0 ? (u - cdf[index]) / bucketWidth : 0.5;
+		return index;
+	}
+
+	Vector3 EnvironmentMap::Sample(double u1, double u2, EnvironmentSampling strategy, double& pdf) const
+	{
+		if (strategy == EnvironmentSampling::Uniform || totalWeight <= 0.0)
+		{
+			pdf = sampling::UniformSpherePdf();
+			return sampling::SampleUniformSphere(u1, u2);
+		}
+
+		double dv, du;
+		size_t row = SampleCdf(marginalCdf.data(), height, u1, dv);
+		size_t column = SampleCdf(&conditionalCdf[row * (width + 1)], width, u2, du);
+
+		auto theta = consts::pi * (row + dv) / height;
+		auto phi = 2.0 * consts::pi * (column + du) / width;
+		auto sinTheta = std::sin(theta);
+		if (sinTheta <= 0.0)
+		{
+			pdf = 0.0;
+			return Vector3(0.0, 1.0, 0.0);
+		}
+
+		// Density over the unit square of the map, converted to solid angle.
+		auto uvPdf = TexelWeight(static_cast<int>(column), static_cast<int>(row)) / totalWeight * width * height;
+		pdf = uvPdf / (2.0 * consts::pi * consts::pi * sinTheta);
+		return Vector3(sinTheta * std::cos(phi), std::cos(theta), sinTheta * std::sin(phi));
+	}
+
+	double EnvironmentMap::Pdf(const Vector3& direction, EnvironmentSampling strategy) const
+	{
+		if (strategy == EnvironmentSampling::Uniform || totalWeight <= 0.0)
+		{
+			return sampling::UniformSpherePdf();
+		}
+
+		auto sinTheta = std::sqrt(std::max(0.0, 1.0 - direction.Y() * direction.Y()));
+		if (sinTheta <= 0.0)
+		{
+			return 0.0;
+		}
+
+		int column, row;
+		DirectionToTexel(direction, column, row);
+		auto uvPdf = TexelWeight(column, row) / totalWeight * width * height;
+		return uvPdf / (2.0 * consts::pi * consts::pi * sinTheta);
+	}
+}
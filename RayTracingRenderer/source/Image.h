@@ -8,9 +8,13 @@
 #include <string>
 #include <fstream>
 
+#if defined(_MSC_VER)
 #define __STDC_LIB_EXT1__
+#endif
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
 
 namespace rtr
 {
@@ -27,7 +31,8 @@ namespace rtr
 		return charBuffer;
 	}
 
-	void SaveImage(const std::string fileName, const std::vector<float>& imageBuffer, int imageWidth, int imageHeight)
+	// Returns false when the extension is not supported or the file cannot be written.
+	bool SaveImage(const std::string fileName, const std::vector<float>& imageBuffer, int imageWidth, int imageHeight)
 	{
 		auto extension = fileName.substr(fileName.find_last_of(".") + 1);
 		if (extension == "ppm")
@@ -39,25 +44,43 @@ namespace rtr
 				auto pixelColor = Color(imageBuffer[i], imageBuffer[i + 1], imageBuffer[i + 2]);
 				file << pixelColor;
 			}
+			return static_cast<bool>(file.flush());
 		}
 		else if (extension == "png")
 		{
 			auto byteBuffer = ConvertFloatBufferToBytes(imageBuffer, imageWidth, imageHeight);
-			stbi_write_png(fileName.c_str(), imageWidth, imageHeight, consts::channels, (void*)&byteBuffer[0], 0);
+			return stbi_write_png(fileName.c_str(), imageWidth, imageHeight, consts::channels, (void*)&byteBuffer[0], 0) != 0;
 		}
 		else if (extension == "bmp")
 		{
 			auto byteBuffer = ConvertFloatBufferToBytes(imageBuffer, imageWidth, imageHeight);
-			stbi_write_bmp(fileName.c_str(), imageWidth, imageHeight, consts::channels, (void*)&byteBuffer[0]);
+			return stbi_write_bmp(fileName.c_str(), imageWidth, imageHeight, consts::channels, (void*)&byteBuffer[0]) != 0;
 		}
 		else if (extension == "jpg")
 		{
 			auto byteBuffer = ConvertFloatBufferToBytes(imageBuffer, imageWidth, imageHeight);
-			stbi_write_jpg(fileName.c_str(), imageWidth, imageHeight, consts::channels, (void*)&byteBuffer[0], 100);
+			return stbi_write_jpg(fileName.c_str(), imageWidth, imageHeight, consts::channels, (void*)&byteBuffer[0], 100) != 0;
 		}
 		else
 		{
 			std::cout << "Not supported file extension.\n";
+			return false;
 		}
 	}
-}
\ No newline at end of file
+
+	// Loads an image as linear float RGB, HDR files keep their full range.
+	bool LoadFloatImage(const std::string& fileName, std::vector<float>& imageBuffer, int& imageWidth, int& imageHeight)
+	{
+		int channelsInFile;
+		float* data = stbi_loadf(fileName.c_str(), &imageWidth, &imageHeight, &channelsInFile, consts::channels);
+		if (data == nullptr)
+		{
+			std::cout << "Cannot load image " << fileName << ": " << stbi_failure_reason() << '\n';
+			return false;
+		}
+
+		imageBuffer.assign(data, data + static_cast<size_t>(imageWidth) * imageHeight * consts::channels);
+		stbi_image_free(data);
+		return true;
+	}
+}
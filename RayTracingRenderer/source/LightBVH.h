@@ -0,0 +1,282 @@
+#pragma once
+
+#include "AABB.h"
+#include "Material.h"
+#include "Sphere.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace rtr
+{
+	enum class LightSampling
+	{
+		Uniform,
+		Hierarchy
+	};
+
+	// Conservative bounds of a group of emitters: where they are, how much power they emit
+	// and in which directions (cone of normals around w with spread thetaO, emission falloff thetaE).
+	struct LightBounds
+	{
+		AABB bounds;
+		Vector3 w = Vector3(0.0, 0.0, 1.0);
+		double phi = 0.0;
+		double cosThetaO = 1.0;
+		double cosThetaE = 1.0;
+
+		double Importance(const Point3& point, const Vector3& normal) const;
+	};
+
+	namespace detail
+	{
+		inline double SafeSqrt(double x)
+		{
+			return std::sqrt(std::max(0.0, x));
+		}
+
+		// cos(max(0, a - b)) and sin(max(0, a - b)) from sines and cosines of a and b.
+		inline double CosSubClamped(double sinA, double cosA, double sinB, double cosB)
+		{
+			return cosA > cosB ? 1.0 : cosA * cosB + sinA * sinB;
+		}
+
+		inline double SinSubClamped(double sinA, double cosA, double sinB, double cosB)
+		{
+			return cosA > cosB ? 0.0 : sinA * cosB - cosA * sinB;
+		}
+
+		inline Vector3 Rotate(const Vector3& v, const Vector3& axis, double theta)
+		{
+			// Rodrigues' rotation formula.
+			auto cosTheta = std::cos(theta);
+			auto sinTheta = std::sin(theta);
+			return cosTheta * v + sinTheta * Cross(axis, v) + (1.0 - cosTheta) * Dot(axis, v) * axis;
+		}
+	}
+
+	double LightBounds::Importance(const Point3& point, const Vector3& normal) const
+	{
+		// Distance to the box center, clamped so points inside the box do not blow up.
+		Point3 center = bounds.Centroid();
+		auto distanceSquared = std::max((point - center).LengthSquared(), bounds.Diagonal().Lenght() / 2.0);
+
+		Vector3 toPoint = Normalize(point - center);
+		auto cosThetaW = Dot(w, toPoint);
+		auto sinThetaW = detail::SafeSqrt(1.0 - cosThetaW * cosThetaW);
+
+		// Angle subtended by the bounding sphere of the box.
+		auto radiusSquared = bounds.Diagonal().LengthSquared() / 4.0;
+		auto centerDistanceSquared = (point - center).LengthSquared();
+		auto cosThetaB = centerDistanceSquared < radiusSquared ? -1.0 : detail::SafeSqrt(1.0 - radiusSquared / centerDistanceSquared);
+		auto sinThetaB = detail::SafeSqrt(1.0 - cosThetaB * cosThetaB);
+
+		// Smallest possible angle between an emitter normal and the direction to the point.
+		auto sinThetaO = detail::SafeSqrt(1.0 - cosThetaO * cosThetaO);
+		auto cosThetaX = detail::CosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+		auto sinThetaX = detail::SinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+		auto cosThetaP = detail::CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+		if (cosThetaP <= cosThetaE)
+		{
+			return 0.0;
+		}
+
+		// Smallest possible incident angle at the shading point.
+		auto cosThetaI = Dot(-toPoint, normal);
+		auto sinThetaI = detail::SafeSqrt(1.0 - cosThetaI * cosThetaI);
+		auto cosThetaPI = detail::CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+
+		return std::max(0.0, phi * cosThetaP * cosThetaPI / distanceSquared);
+	}
+
+	LightBounds Union(const LightBounds& a, const LightBounds& b)
+	{
+		if (a.phi == 0.0)
+		{
+			return b;
+		}
+		if (b.phi == 0.0)
+		{
+			return a;
+		}
+
+		LightBounds result;
+		result.bounds = Union(a.bounds, b.bounds);
+		result.phi = a.phi + b.phi;
+		result.cosThetaE = std::min(a.cosThetaE, b.cosThetaE);
+
+		// Smallest cone containing both orientation cones.
+		auto thetaA = std::acos(std::clamp(a.cosThetaO, -1.0, 1.0));
+		auto thetaB = std::acos(std::clamp(b.cosThetaO, -1.0, 1.0));
+		auto thetaD = std::acos(std::clamp(Dot(a.w, b.w), -1.0, 1.0));
+		if (std::min(thetaD + thetaB, consts::pi) <= thetaA)
+		{
+			result.w = a.w;
+			result.cosThetaO = a.cosThetaO;
+			return result;
+		}
+		if (std::min(thetaD + thetaA, consts::pi) <= thetaB)
+		{
+			result.w = b.w;
+			result.cosThetaO = b.cosThetaO;
+			return result;
+		}
+
+		auto thetaO = (thetaA + thetaD + thetaB) / 2.0;
+		Vector3 axis = Cross(a.w, b.w);
+		if (thetaO >= consts::pi || axis.LengthSquared() == 0.0)
+		{
+			result.w = a.w;
+			result.cosThetaO = -1.0;
+			return result;
+		}
+
+		result.w = detail::Rotate(a.w, Normalize(axis), thetaO - thetaA);
+		result.cosThetaO = std::cos(thetaO);
+		return result;
+	}
+
+	// Light hierarchy for picking one of many emitters proportionally to its estimated contribution
+	// at a shading point. Nodes are stored depth-first: the first child directly follows its parent.
+	class LightBVH
+	{
+	public:
+		LightBVH() {}
+
+		void Build(const std::vector<std::shared_ptr<Sphere>>& sceneLights);
+
+		bool IsEmpty() const
+		{
+			return nodes.empty();
+		}
+
+		const Sphere* Sample(const Point3& point, const Vector3& normal, double u, double& pmf) const;
+
+	private:
+		struct Node
+		{
+			LightBounds lightBounds;
+			int index; // Second child for interior nodes, light for leaves.
+			bool isLeaf;
+		};
+
+		static LightBounds SphereLightBounds(const Sphere& light);
+
+		int BuildRecursive(std::vector<std::pair<LightBounds, int>>& items, size_t begin, size_t end);
+
+		std::vector<Node> nodes;
+		std::vector<std::shared_ptr<Sphere>> lights;
+	};
+
+	LightBounds LightBVH::SphereLightBounds(const Sphere& light)
+	{
+		// Spheres emit in every direction, so the orientation cone is the entire sphere of directions.
+		LightBounds lightBounds;
+		lightBounds.bounds = light.BoundingBox();
+		lightBounds.phi = light.material->Emitted().Luminance() * consts::pi * light.Area();
+		lightBounds.cosThetaO = -1.0;
+		lightBounds.cosThetaE = 0.0;
+		return lightBounds;
+	}
+
+	void LightBVH::Build(const std::vector<std::shared_ptr<Sphere>>& sceneLights)
+	{
+		nodes.clear();
+		lights.clear();
+
+		std::vector<std::pair<LightBounds, int>> items;
+		for (const auto& light : sceneLights)
+		{
+			auto lightBounds = SphereLightBounds(*light);
+			if (lightBounds.phi > 0.0)
+			{
+				items.emplace_back(lightBounds, static_cast<int>(lights.size()));
+				lights.push_back(light);
+			}
+		}
+
+		if (!items.empty())
+		{
+			nodes.reserve(2 * items.size() - 1);
+			BuildRecursive(items, 0, items.size());
+		}
+	}
+
+	int LightBVH::BuildRecursive(std::vector<std::pair<LightBounds, int>>& items, size_t begin, size_t end)
+	{
+		int nodeIndex = static_cast<int>(nodes.size());
+		nodes.push_back(Node());
+
+		if (end - begin == 1)
+		{
+			nodes[nodeIndex] = { items[begin].first, items[begin].second, true };
+			return nodeIndex;
+		}
+
+		// Median split along the longest axis of the light centroids.
+		AABB centroidBounds;
+		for (size_t i = begin; i < end; i++)
+		{
+			centroidBounds = Union(centroidBounds, items[i].first.bounds.Centroid());
+		}
+		int axis = centroidBounds.LongestAxis();
+		size_t middle = (begin + end) / 2;
+		std::nth_element(items.begin() + begin, items.begin() + middle, items.begin() + end,
+			[axis](const auto& a, const auto& b)
+			{
+				return Axis(a.first.bounds.Centroid(), axis) < Axis(b.first.bounds.Centroid(), axis);
+			});
+
+		BuildRecursive(items, begin, middle);
+		int secondChild = BuildRecursive(items, middle, end);
+
+		nodes[nodeIndex].lightBounds = Union(nodes[nodeIndex + 1].lightBounds, nodes[secondChild].lightBounds);
+		nodes[nodeIndex].index = secondChild;
+		nodes[nodeIndex].isLeaf = false;
+		return nodeIndex;
+	}
+
+	const Sphere* LightBVH::Sample(const Point3& point, const Vector3& normal, double u, double& pmf) const
+	{
+		pmf = 1.0;
+		if (nodes.empty())
+		{
+			return nullptr;
+		}
+
+		// Stochastic traversal: descend into a child with probability proportional to its importance
+		// and reuse the remaining part of u for the next decision.
+		int nodeIndex = 0;
+		while (!nodes[nodeIndex].isLeaf)
+		{
+			const Node& node = nodes[nodeIndex];
+			auto firstImportance = nodes[nodeIndex + 1].lightBounds.Importance(point, normal);
+			auto secondImportance = nodes[node.index].lightBounds.Importance(point, normal);
+			if (firstImportance == 0.0 && secondImportance == 0.0)
+			{
+				return nullptr;
+			}
+
+			auto firstProbability = firstImportance / (firstImportance + secondImportance);
+			if (u < firstProbability)
+			{
+				nodeIndex = nodeIndex + 1;
+				u = std::min(u / firstProbability, consts::oneMinusEpsilon);
+				pmf *= firstProbability;
+			}
+			else
+			{
+				nodeIndex = node.index;
+				u = std::min((u - firstProbability) / (1.0 - firstProbability), consts::oneMinusEpsilon);
+				pmf *= 1.0 - firstProbability;
+			}
+		}
+
+		if (nodeIndex == 0 && nodes[0].lightBounds.Importance(point, normal) == 0.0)
+		{
+			return nullptr;
+		}
+		return lights[nodes[nodeIndex].index].get();
+	}
+}
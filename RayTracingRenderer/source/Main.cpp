@@ -1,5 +1,6 @@
 #include "Color.h"
 #include "Renderer.h"
+#include "RenderServer.h"
 #include "Vector3.h"
 #include "Sphere.h"
 #include "Scene.h"
@@ -8,8 +9,13 @@
 #include "Camera.h"
 #include "Material.h"
 #include "Image.h"
+#include "Batch.h"
+#include "Benchmark.h"
+#include "Distributed.h"
+#include "SharedFramebuffer.h"
 
 #include <iostream>
+#include <stdexcept>
 
 
 namespace rtr
@@ -36,28 +42,29 @@ namespace rtr
 	Scene GenerateRandomScene()
 	{
 		Scene scene;
+		Random random;
 
 		auto groundMaterial = std::make_shared<LambertianMaterial>(Color(0.8, 0.8, 0.8));
 		scene.Add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, groundMaterial));
 
 		for (int a = -11; a < 11; a++) {
 			for (int b = -11; b < 11; b++) {
-				auto materialSelection = util::RandomDouble();
-				Point3 center(a + 0.9 * util::RandomDouble(), 0.2, b + 0.9 * util::RandomDouble());
+				auto materialSelection = util::RandomDouble(random);
+				Point3 center(a + 0.9 * util::RandomDouble(random), 0.2, b + 0.9 * util::RandomDouble(random));
 
 				if ((center - Point3(4, 0.2, 0)).Lenght() > 0.9) {
 					std::shared_ptr<Material> sphereMaterial;
 
 					if (materialSelection < 0.8) {
 						// Diffuse.
-						auto albedo = util::RandomColor() * util::RandomColor();
+						auto albedo = util::RandomColor(random) * util::RandomColor(random);
 						sphereMaterial = std::make_shared<LambertianMaterial>(albedo);
 						scene.Add(std::make_shared<Sphere>(center, 0.2, sphereMaterial));
 					}
 					else if (materialSelection < 0.95) {
 						// Metal.
-						auto albedo = util::RandomColor(0.5, 1);
-						auto fuzz = util::RandomDouble(0, 0.5);
+						auto albedo = util::RandomColor(random, 0.5, 1);
+						auto fuzz = util::RandomDouble(random, 0, 0.5);
 						sphereMaterial = std::make_shared<MetalMaterial>(albedo, fuzz);
 						scene.Add(std::make_shared<Sphere>(center, 0.2, sphereMaterial));
 					}
@@ -81,9 +88,52 @@ namespace rtr
 
 		return scene;
 	}
+
+	Scene GenerateManyLightsScene(int lightsCount)
+	{
+		Scene scene;
+		Random random;
+		scene.SetBackground(Color(0.0, 0.0, 0.0));
+
+		auto groundMaterial = std::make_shared<LambertianMaterial>(Color(0.8, 0.8, 0.8));
+		scene.Add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, groundMaterial));
+
+		for (int a = -3; a <= 3; a++) {
+			auto material = std::make_shared<LambertianMaterial>(util::RandomColor(random, 0.2, 0.9));
+			scene.Add(std::make_shared<Sphere>(Point3(2.5 * a, 1, 0), 1.0, material));
+		}
+
+		// Small emitters with widely varying power spread over the whole scene.
+		for (int i = 0; i < lightsCount; i++) {
+			Point3 center(util::RandomDouble(random, -20, 20), util::RandomDouble(random, 0.1, 4), util::RandomDouble(random, -20, 20));
+			auto emit = util::RandomColor(random, 0.2, 1) * std::pow(10.0, util::RandomDouble(random, 0, 3));
+			scene.AddLight(std::make_shared<Sphere>(center, 0.05, std::make_shared<DiffuseLightMaterial>(emit)));
+		}
+
+		scene.BuildLightHierarchy();
+		return scene;
+	}
+
+	// Scenes distributed renders and the render server can refer to by name. Unknown names throw.
+	Scene GenerateScene(const std::string& name)
+	{
+		if (name == "random")
+		{
+			return GenerateRandomScene();
+		}
+		if (name == "preview")
+		{
+			return GeneratePreviewScene();
+		}
+		if (name == "lights")
+		{
+			return GenerateManyLightsScene(10000);
+		}
+		throw std::invalid_argument("Unknown scene: " + name);
+	}
 }
 
-int main()
+int main(int argc, char* argv[])
 {
 	const std::string fileName = "C:/Users/Kamil/source/repos/RayTracingRenderer/x64/Release/imageLowNoiseDenoisedAux2.bmp";
 
@@ -104,6 +154,285 @@ int main()
 	double cameraDistToFocus = 10;
 
 	rtr::Camera camera(cameraPosition, cameraLookAt, viewUp, cameraFov, aspectRatio, cameraAperture, cameraDistToFocus);
+	rtr::DistributedJob job{ "random", { cameraPosition, cameraLookAt, viewUp, cameraFov, aspectRatio, cameraAperture, cameraDistToFocus },
+		imageWidth, imageHeight, samplesPerPixel, maxDepth };
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-lights")
+	{
+		// Noise of uniform and hierarchical light selection with 10k emitters at an equal time budget.
+		auto lightsScene = rtr::GenerateManyLightsScene(10000);
+		rtr::Camera lightsCamera(rtr::Point3(0, 6, 18), rtr::Point3(0, 1, 0), viewUp, 40.0, aspectRatio, 0.0, 10.0);
+		rtr::bench::BenchmarkLightSampling(lightsCamera, lightsScene, 320, 180, maxDepth, 60000.0, "lights_");
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-threads")
+	{
+		auto threadsScene = rtr::GenerateRandomScene();
+		int maxThreads = argc > 2 ? std::stoi(argv[2]) : 64;
+		for (int tileSize : { 8, 16, 32, 64 })
+		{
+			rtr::bench::BenchmarkThreadScaling(camera, threadsScene, 400, 225, 8, maxDepth, maxThreads, tileSize);
+		}
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-tile-order")
+	{
+		rtr::bench::BenchmarkTileOrders(camera, rtr::GenerateRandomScene(), 800, 450, 4, maxDepth, 16);
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-features")
+	{
+		rtr::bench::BenchmarkFusedFeatures(camera, rtr::GenerateRandomScene(), 400, 225, 30, maxDepth);
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-batch")
+	{
+		rtr::bench::BenchmarkBatch(rtr::GenerateRandomScene, rtr::OrbitFrames(job.camera, 16, "batch_"), 200, 112, 2, maxDepth);
+		return 0;
+	}
+
+	if (argc > 2 && std::string(argv[1]) == "--batch")
+	{
+		// Renders the given number of frames around the scene into frame_000.bmp, frame_001.bmp, ...
+		rtr::Renderer batchRenderer(imageWidth, imageHeight);
+		auto report = rtr::RenderBatch(batchRenderer, rtr::GenerateRandomScene, rtr::OrbitFrames(job.camera, std::stoi(argv[2]), "frame_"), samplesPerPixel, maxDepth);
+		std::cout << "Frames: " << report.framesCount << ", total " << report.totalMs << " ms, " << report.amortizedFrameMs << " ms per frame\n";
+		return 0;
+	}
+
+	rtr::RenderRequest preview;
+	preview.scene = "random";
+	preview.camera = job.camera;
+	preview.imageWidth = 160;
+	preview.imageHeight = 90;
+	preview.samplesPerPixel = 4;
+	preview.maxDepth = maxDepth;
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-server")
+	{
+		rtr::bench::BenchmarkRenderServer(preview, rtr::GenerateScene, argc > 2 ? std::stoi(argv[2]) : 4, 8);
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--server")
+	{
+		// Renders jobs of local clients until one of them asks for a shutdown.
+		rtr::RenderServer server(argc > 2 ? std::stoi(argv[2]) : 7880, rtr::GenerateScene);
+		if (!server.IsListening())
+		{
+			std::cout << "Cannot listen on the port\n";
+			return 1;
+		}
+		std::cout << "Render server on port " << server.Port() << '\n';
+		server.Run();
+		return 0;
+	}
+
+	if (argc > 3 && std::string(argv[1]) == "--request")
+	{
+		// Sends a preview of the default view to the server on the given port: --request port output [spp],
+		// or --request port --stats / --shutdown.
+		rtr::RenderClient client("127.0.0.1", std::stoi(argv[2]));
+		rtr::ServerStats stats;
+		if (std::string(argv[3]) == "--shutdown")
+		{
+			return client.Shutdown() ? 0 : 1;
+		}
+		if (std::string(argv[3]) != "--stats")
+		{
+			preview.outputPath = argv[3];
+			preview.samplesPerPixel = argc > 4 ? std::stoi(argv[4]) : preview.samplesPerPixel;
+			preview.returnImage = false;
+			rtr::RenderResponse response;
+			if (!client.Render(preview, response) || !response.ok)
+			{
+				std::cout << "Render failed " << response.error << '\n';
+				return 1;
+			}
+			std::cout << "Queued behind " << response.queueDepth << " jobs, queue " << response.queueMs << " ms, render " << response.renderMs << " ms\n";
+		}
+		if (!client.Stats(stats))
+		{
+			return 1;
+		}
+		std::cout << "Jobs done " << stats.jobsDone << ", queue depth " << stats.queueDepth << " (max " << stats.maxQueueDepth << "), latency p50 "
+			<< stats.latencyP50Ms << " ms, p90 " << stats.latencyP90Ms << " ms, p99 " << stats.latencyP99Ms << " ms\n";
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-distributed")
+	{
+		rtr::DistributedJob benchmarkJob = job;
+		benchmarkJob.imageWidth = 400;
+		benchmarkJob.imageHeight = 225;
+		benchmarkJob.samplesPerPixel = 8;
+		rtr::bench::BenchmarkDistributed(benchmarkJob, rtr::GenerateScene, argc > 2 ? std::stoi(argv[2]) : 8);
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-shared-memory")
+	{
+		rtr::DistributedJob benchmarkJob = job;
+		benchmarkJob.imageWidth = 400;
+		benchmarkJob.imageHeight = 225;
+		benchmarkJob.samplesPerPixel = 8;
+		benchmarkJob.tileSize = 32;
+		rtr::bench::BenchmarkSharedFramebuffer(argv[0], benchmarkJob, rtr::GenerateScene, argc > 2 ? std::stoi(argv[2]) : 8);
+		return 0;
+	}
+
+	if (argc > 2 && std::string(argv[1]) == "--shared-memory-worker")
+	{
+		// Fills the tiles of a framebuffer created by --benchmark-shared-memory, with the given number of threads.
+		auto framebuffer = rtr::SharedFramebuffer::Open(argv[2]);
+		if (!framebuffer)
+		{
+			std::cout << "Cannot open the shared memory segment\n";
+			return 1;
+		}
+		return rtr::RunSharedFramebufferWorker(*framebuffer, rtr::GenerateScene, argc > 3 ? std::stoi(argv[3]) : 0) >= 0 ? 0 : 1;
+	}
+
+	if (argc > 3 && std::string(argv[1]) == "--worker")
+	{
+		// Renders work items of the coordinator at host port with all local threads until the frame is done.
+		auto report = rtr::RunWorker(argv[2], std::stoi(argv[3]), rtr::GenerateScene);
+		std::cout << "Work items: " << report.workItemsCount << ", render time: " << report.renderTimeMs << " ms" << (report.completed ? "" : ", connection lost") << '\n';
+		return report.completed ? 0 : 1;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--coordinator")
+	{
+		// Waits for --worker processes on the given port and saves the assembled frame without denoising:
+		// [port [any]], where any accepts workers from other machines instead of this one only.
+		const auto listenAddress = argc > 3 && std::string(argv[3]) == "any" ? rtr::net::ListenAddress::AnyInterface : rtr::net::ListenAddress::Loopback;
+		rtr::Coordinator coordinator(argc > 2 ? std::stoi(argv[2]) : 7878, listenAddress);
+		if (!coordinator.IsListening())
+		{
+			std::cout << "Cannot listen on the port\n";
+			return 1;
+		}
+		std::cout << "Waiting for workers on port " << coordinator.Port() << '\n';
+		rtr::AccumulationBuffer accumulation(imageWidth, imageHeight);
+		auto report = coordinator.Render(job, accumulation);
+		std::cout << "Workers: " << report.workersCount << ", work items: " << report.workItemsCount << ", requeued: " << report.requeuedWorkItemsCount
+			<< ", render time: " << report.renderTimeMs << " ms\n";
+		if (!report.completed)
+		{
+			std::cout << "Gave up waiting for workers\n";
+			return 1;
+		}
+
+		std::vector<float> imageBuffer;
+		accumulation.Snapshot(imageBuffer);
+		rtr::SaveImage(fileName, imageBuffer, imageWidth, imageHeight);
+		return 0;
+	}
+
+	if (argc > 4 && std::string(argv[1]) == "--partial")
+	{
+		// Saves samples [offset, offset + spp) of the frame with the given seed for --merge: output offset spp [seed [total]],
+		// where total is the end of the whole sample range split between runs, for stratifying samplers.
+		rtr::Renderer partialRenderer(imageWidth, imageHeight);
+		partialRenderer.SetSampleOffset(std::stoi(argv[3]));
+		partialRenderer.SetSeed(argc > 5 ? std::stoull(argv[5]) : 0);
+		rtr::PartialSampleBuffer samples(imageWidth, imageHeight);
+		const bool completed = partialRenderer.RenderPartialSamples(camera, rtr::GenerateScene(job.scene), std::stoi(argv[4]), maxDepth, samples, argc > 6 ? std::stoi(argv[6]) : 0);
+		return completed && rtr::WritePartialSamples(argv[2], samples) ? 0 : 1;
+	}
+
+	if (argc > 3 && std::string(argv[1]) == "--merge")
+	{
+		// Adds --partial files into one: output input...
+		std::string error;
+		if (!rtr::MergePartialSamples(std::vector<std::string>(argv + 3, argv + argc), argv[2], &error))
+		{
+			std::cout << error << '\n';
+			return 1;
+		}
+		return 0;
+	}
+
+	if (argc > 3 && std::string(argv[1]) == "--resolve")
+	{
+		// Saves the image of a --partial or --merge file without denoising: input output.
+		std::vector<float> imageBuffer;
+		int partialWidth = 0, partialHeight = 0;
+		if (!rtr::ResolvePartialSamples(argv[2], imageBuffer, partialWidth, partialHeight))
+		{
+			std::cout << "Cannot read " << argv[2] << '\n';
+			return 1;
+		}
+		rtr::SaveImage(argv[3], imageBuffer, partialWidth, partialHeight);
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-numa")
+	{
+		rtr::bench::BenchmarkNumaPlacement(camera, rtr::GenerateRandomScene(), 1920, 1080, 4, maxDepth);
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-progressive")
+	{
+		rtr::bench::BenchmarkProgressive(camera, rtr::GenerateRandomScene(), 400, 225, 64, maxDepth);
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-time-budget")
+	{
+		rtr::bench::BenchmarkTimeBudget(camera, rtr::GenerateRandomScene(), 800, 450, maxDepth, "budget_");
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-adaptive")
+	{
+		rtr::bench::BenchmarkAdaptiveSampling(camera, rtr::GenerateRandomScene(), 400, 225, maxDepth, 4096, "adaptive_");
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-random")
+	{
+		rtr::bench::BenchmarkRandom();
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-samplers")
+	{
+		rtr::Camera previewCamera(rtr::Point3(0, 0.5, 2), rtr::Point3(0, 0, -1), viewUp, 60.0, aspectRatio, 0.0, 3.0);
+		std::cout << "Preview scene:\n";
+		rtr::bench::BenchmarkSamplers(previewCamera, rtr::GeneratePreviewScene(), 320, 180, maxDepth, 2000.0, 4096);
+		std::cout << "Random scene:\n";
+		rtr::bench::BenchmarkSamplers(camera, rtr::GenerateRandomScene(), 320, 180, maxDepth, 5000.0, 1024);
+		return 0;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-blue-noise")
+	{
+		rtr::Camera previewCamera(rtr::Point3(0, 0.5, 2), rtr::Point3(0, 0, -1), viewUp, 60.0, aspectRatio, 0.0, 3.0);
+		std::cout << "Preview scene:\n";
+		rtr::bench::BenchmarkBlueNoise(previewCamera, rtr::GeneratePreviewScene(), 320, 180, maxDepth, 4096);
+		std::cout << "Random scene:\n";
+		rtr::bench::BenchmarkBlueNoise(camera, rtr::GenerateRandomScene(), 320, 180, maxDepth, 1024);
+		return 0;
+	}
+
+	if (argc > 2 && std::string(argv[1]) == "--benchmark-environment")
+	{
+		auto environmentScene = rtr::GeneratePreviewScene();
+		auto environment = std::make_shared<rtr::EnvironmentMap>(argv[2]);
+		if (!environment->IsValid())
+		{
+			return 1;
+		}
+		environmentScene.SetEnvironment(environment);
+		rtr::Camera environmentCamera(rtr::Point3(0, 0.5, 2), rtr::Point3(0, 0, -1), viewUp, 60.0, aspectRatio, 0.0, 3.0);
+		rtr::bench::BenchmarkEnvironmentSampling(environmentCamera, environmentScene, 320, 180, maxDepth, 20000.0, "environment_");
+		return 0;
+	}
 
 	auto scene = rtr::GenerateRandomScene();
 
@@ -117,15 +446,33 @@ int main()
 	imageOutBuffer.resize(static_cast<size_t>(imageWidth) * imageHeight * 3, 0.0f);
 
 	rtr::Renderer renderer(imageWidth, imageHeight);
-	renderer.RenderImage(camera, scene, samplesPerPixel, maxDepth, imageBuffer);
+	if (argc > 5 && std::string(argv[1]) == "--region")
+	{
+		// Renders and saves only the given rectangle of the frame: x0 y0 x1 y1, rows from the top.
+		renderer.SetCropWindow({ std::stoi(argv[2]), std::stoi(argv[3]), std::stoi(argv[4]), std::stoi(argv[5]) }, true);
+	}
+
+	if (argc > 2 && std::string(argv[1]) == "--checkpoint")
+	{
+		// Running again with the same file continues from the last checkpoint.
+		rtr::AccumulationBuffer accumulation(imageWidth, imageHeight);
+		renderer.RenderWithCheckpoints(camera, scene, samplesPerPixel, maxDepth, accumulation, { argv[2], 60.0, 5 });
+		accumulation.Snapshot(imageBuffer);
 
-	camera.SetAperture(0.0);
-	renderer.RenderAlbedo(camera, scene, samplesPerPixel / 3, albedoBuffer);
-	renderer.RenderNormal(camera, scene, samplesPerPixel / 3, normalBuffer);
+		camera.SetAperture(0.0);
+		renderer.RenderAlbedo(camera, scene, samplesPerPixel / 3, albedoBuffer);
+		renderer.RenderNormal(camera, scene, samplesPerPixel / 3, normalBuffer);
+	}
+	else
+	{
+		// Albedo and normal come from the same primary hits as the image, so unlike the pinhole feature passes
+		// above they include the camera's defocus blur.
+		renderer.RenderImageWithFeatures(camera, scene, samplesPerPixel, maxDepth, imageBuffer, &albedoBuffer, &normalBuffer);
+	}
 
 	renderer.DenoiseImage(imageBuffer, albedoBuffer, normalBuffer, imageOutBuffer);
 	
-	rtr::SaveImage(fileName, imageOutBuffer, imageWidth, imageHeight);
+	rtr::SaveImage(fileName, imageOutBuffer, renderer.OutputWidth(), renderer.OutputHeight());
 
 	std::cout << "Done\n";
 }
@@ -9,7 +9,31 @@ namespace rtr
 	class Material
 	{
 	public:
-		virtual bool Scatter(const Ray& inputRay, const HitRecord& hitRecord, Color& attenuation, Ray& scatteredRay) const = 0;
+		virtual bool Scatter(const Ray& inputRay, const HitRecord& hitRecord, Color& attenuation, Ray& scatteredRay, Sampler& sampler) const = 0;
+
+		virtual Color Emitted() const
+		{
+			return Color(0.0, 0.0, 0.0);
+		}
+
+		// Materials with delta lobes (mirrors, glass) cannot be evaluated for an arbitrary direction,
+		// so they are skipped by explicit light sampling.
+		virtual bool IsSpecular() const
+		{
+			return true;
+		}
+
+		// BRDF times cosine for light arriving from the given direction.
+		virtual Color Evaluate(const HitRecord& /*hitRecord*/, const Vector3& /*direction*/) const
+		{
+			return Color(0.0, 0.0, 0.0);
+		}
+
+		// Solid angle density of the directions produced by Scatter.
+		virtual double Pdf(const HitRecord& /*hitRecord*/, const Vector3& /*direction*/) const
+		{
+			return 0.0;
+		}
 	};
 
 	class LambertianMaterial : public Material
@@ -17,19 +41,14 @@ namespace rtr
 	public:
 		LambertianMaterial(const Color& color) : albedo(color) {}
 
-		virtual bool Scatter(const Ray& inputRay, const HitRecord& hitRecord, Color& attenuation, Ray& scatteredRay) const override
+		virtual bool Scatter(const Ray& inputRay, const HitRecord& hitRecord, Color& attenuation, Ray& scatteredRay, Sampler& sampler) const override
 		{
 			// Pseudo Lambertial reflection - harder shadows
 			// auto scatterDirection = hitRecord.normal + RandomVectorInUnitSphere();
 			// Hemisphere model - even softer shadows
 			// auto scatterDirection = RandomVectorInHemisphere(hitRecord.normal);
-			// True Lambertian reflection
-			auto scatterDirection = hitRecord.normal + util::RandomUnitVector();
-
-			if (scatterDirection.IsNearZero())
-			{
-				scatterDirection = hitRecord.normal;
-			}
+			// True Lambertian reflection, sampled directly from the cosine-weighted hemisphere.
+			auto scatterDirection = util::RandomCosineDirection(sampler, hitRecord.normal);
 
 			scatteredRay = Ray(hitRecord.point, scatterDirection);
 			attenuation = albedo;
@@ -38,6 +57,22 @@ namespace rtr
 			// OR scatter with probability p and attenuate with albedo/p.
 		}
 
+		virtual bool IsSpecular() const override
+		{
+			return false;
+		}
+
+		virtual Color Evaluate(const HitRecord& hitRecord, const Vector3& direction) const override
+		{
+			auto cosine = Dot(hitRecord.normal, direction);
+			return cosine > 0.0 ? (cosine / consts::pi) * albedo : Color(0.0, 0.0, 0.0);
+		}
+
+		virtual double Pdf(const HitRecord& hitRecord, const Vector3& direction) const override
+		{
+			return sampling::CosineHemispherePdf(Dot(hitRecord.normal, direction));
+		}
+
 		Color albedo;
 	};
 
@@ -46,10 +81,10 @@ namespace rtr
 	public:
 		MetalMaterial(const Color& color, double fuziness) : albedo(color), fuziness(std::clamp(fuziness, 0.0, 1.0)) {}
 
-		virtual bool Scatter(const Ray& inputRay, const HitRecord& hitRecord, Color& attenuation, Ray& scatteredRay) const override
+		virtual bool Scatter(const Ray& inputRay, const HitRecord& hitRecord, Color& attenuation, Ray& scatteredRay, Sampler& sampler) const override
 		{
 			Vector3 reflectedVector = Reflect(inputRay.Direction(), hitRecord.normal);
-			scatteredRay = Ray(hitRecord.point, reflectedVector + fuziness * util::RandomVectorInUnitSphere());
+			scatteredRay = Ray(hitRecord.point, reflectedVector + fuziness * util::RandomVectorInUnitSphere(sampler));
 			attenuation = albedo;
 
 			return (Dot(scatteredRay.Direction(), hitRecord.normal) > 0);
@@ -64,7 +99,7 @@ namespace rtr
 	public:
 		DielectricMaterial(double indexOfRefraction) : ir(indexOfRefraction) {}
 
-		virtual bool Scatter(const Ray& inputRay, const HitRecord& hitRecord, Color& attenuation, Ray& scatteredRay) const override
+		virtual bool Scatter(const Ray& inputRay, const HitRecord& hitRecord, Color& attenuation, Ray& scatteredRay, Sampler& sampler) const override
 		{
 			attenuation = Color(1.0, 1.0, 1.0);
 			double refractonRatio = hitRecord.frontFace ? (1.0 / ir) : ir;
@@ -75,7 +110,7 @@ namespace rtr
 			bool cannotRefeact = refractonRatio * sinTheta > 1.0;
 			Vector3 direction;
 
-			if (cannotRefeact || util::Reflectance(cosTheta, refractonRatio) > util::RandomDouble())
+			if (cannotRefeact || util::Reflectance(cosTheta, refractonRatio) > sampler.Get1D())
 			{
 				direction = Reflect(inputRay.Direction(), hitRecord.normal);
 			}
@@ -90,4 +125,22 @@ namespace rtr
 
 		double ir; // Index of Refraction.
 	};
+
+	class DiffuseLightMaterial : public Material
+	{
+	public:
+		DiffuseLightMaterial(const Color& color) : emit(color) {}
+
+		virtual bool Scatter(const Ray& /*inputRay*/, const HitRecord& /*hitRecord*/, Color& /*attenuation*/, Ray& /*scatteredRay*/, Sampler& /*sampler*/) const override
+		{
+			return false;
+		}
+
+		virtual Color Emitted() const override
+		{
+			return emit;
+		}
+
+		Color emit;
+	};
 }
@@ -0,0 +1,362 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Blocking TCP sockets and length-prefixed messages. Both ends are assumed to share the byte order.
+namespace rtr::net
+{
+#if defined(_WIN32)
+	using SocketHandle = SOCKET;
+	inline constexpr SocketHandle invalidSocket = INVALID_SOCKET;
+#else
+	using SocketHandle = int;
+	inline constexpr SocketHandle invalidSocket = -1;
+#endif
+
+	namespace detail
+	{
+		inline bool StartUp()
+		{
+#if defined(_WIN32)
+			static const bool started = []()
+			{
+				WSADATA data;
+				return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+			}();
+			return started;
+#else
+			return true;
+#endif
+		}
+
+		inline void CloseHandle(SocketHandle handle)
+		{
+#if defined(_WIN32)
+			closesocket(handle);
+#else
+			close(handle);
+#endif
+		}
+	}
+
+	// Every interface makes a listener reachable from other machines, so it has to be asked for.
+	enum class ListenAddress
+	{
+		Loopback,
+		AnyInterface
+	};
+
+	class Socket
+	{
+	public:
+		Socket() = default;
+		explicit Socket(SocketHandle handle) : handle(handle) {}
+		Socket(const Socket&) = delete;
+		Socket& operator=(const Socket&) = delete;
+
+		Socket(Socket&& other) noexcept : handle(std::exchange(other.handle, invalidSocket)) {}
+
+		Socket& operator=(Socket&& other) noexcept
+		{
+			if (this != &other)
+			{
+				Close();
+				handle = std::exchange(other.handle, invalidSocket);
+			}
+			return *this;
+		}
+
+		~Socket()
+		{
+			Close();
+		}
+
+		// Invalid when no address of host accepts the connection.
+		static Socket Connect(const std::string& host, int port)
+		{
+			detail::StartUp();
+			addrinfo hints{};
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			addrinfo* addresses = nullptr;
+			if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+			{
+				return Socket();
+			}
+
+			Socket socket;
+			for (addrinfo* address = addresses; address != nullptr && !socket.IsValid(); address = address->ai_next)
+			{
+				Socket candidate(::socket(address->ai_family, address->ai_socktype, address->ai_protocol));
+				if (candidate.IsValid() && connect(candidate.handle, address->ai_addr, static_cast<int>(address->ai_addrlen)) == 0)
+				{
+					socket = std::move(candidate);
+				}
+			}
+			freeaddrinfo(addresses);
+			socket.DisableDelay();
+			return socket;
+		}
+
+		// Listens on the given IPv4 interfaces; port 0 picks a free port, see LocalPort.
+		static Socket Listen(int port, ListenAddress listenAddress, int backlog = 64)
+		{
+			detail::StartUp();
+			Socket socket(::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+			if (!socket.IsValid())
+			{
+				return socket;
+			}
+			int reuse = 1;
+			setsockopt(socket.handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+			sockaddr_in address{};
+			address.sin_family = AF_INET;
+			address.sin_addr.s_addr = htonl(listenAddress == ListenAddress::Loopback ? INADDR_LOOPBACK : INADDR_ANY);
+			address.sin_port = htons(static_cast<uint16_t>(port));
+			if (bind(socket.handle, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(socket.handle, backlog) != 0)
+			{
+				return Socket();
+			}
+			return socket;
+		}
+
+		Socket Accept() const
+		{
+			Socket socket(accept(handle, nullptr, nullptr));
+			socket.DisableDelay();
+			return socket;
+		}
+
+		bool IsValid() const
+		{
+			return handle != invalidSocket;
+		}
+
+		int LocalPort() const
+		{
+			sockaddr_in address{};
+			socklen_t length = sizeof(address);
+			if (getsockname(handle, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+			{
+				return 0;
+			}
+			return ntohs(address.sin_port);
+		}
+
+		// Waits until data or a connection can be taken without blocking.
+		bool WaitReadable(double timeoutSeconds) const
+		{
+#if defined(_WIN32)
+			WSAPOLLFD descriptor{ handle, POLLRDNORM, 0 };
+			return WSAPoll(&descriptor, 1, static_cast<int>(timeoutSeconds * 1000.0)) > 0;
+#else
+			pollfd descriptor{ handle, POLLIN, 0 };
+			return poll(&descriptor, 1, static_cast<int>(timeoutSeconds * 1000.0)) > 0;
+#endif
+		}
+
+		// Receives fail once nothing arrived for this long; zero waits forever.
+		void SetReceiveTimeout(double seconds)
+		{
+#if defined(_WIN32)
+			DWORD timeout = static_cast<DWORD>(seconds * 1000.0);
+#else
+			timeval timeout{ static_cast<time_t>(seconds), static_cast<suseconds_t>((seconds - static_cast<time_t>(seconds)) * 1e6) };
+#endif
+			setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+		}
+
+		bool SendAll(const void* data, size_t bytes)
+		{
+			const char* position = static_cast<const char*>(data);
+			while (bytes > 0)
+			{
+#if defined(_WIN32)
+				const int sent = send(handle, position, static_cast<int>(std::min<size_t>(bytes, 1 << 30)), 0);
+#else
+				const auto sent = send(handle, position, bytes, MSG_NOSIGNAL);
+#endif
+				if (sent <= 0)
+				{
+					return false;
+				}
+				position += sent;
+				bytes -= static_cast<size_t>(sent);
+			}
+			return true;
+		}
+
+		bool ReceiveAll(void* data, size_t bytes)
+		{
+			char* position = static_cast<char*>(data);
+			while (bytes > 0)
+			{
+#if defined(_WIN32)
+				const int received = recv(handle, position, static_cast<int>(std::min<size_t>(bytes, 1 << 30)), 0);
+#else
+				const auto received = recv(handle, position, bytes, 0);
+#endif
+				if (received <= 0)
+				{
+					return false;
+				}
+				position += received;
+				bytes -= static_cast<size_t>(received);
+			}
+			return true;
+		}
+
+		// Ends both directions, waking a thread blocked in a receive on this socket.
+		void Shutdown()
+		{
+			if (IsValid())
+			{
+#if defined(_WIN32)
+				shutdown(handle, SD_BOTH);
+#else
+				shutdown(handle, SHUT_RDWR);
+#endif
+			}
+		}
+
+		void Close()
+		{
+			if (IsValid())
+			{
+				detail::CloseHandle(handle);
+				handle = invalidSocket;
+			}
+		}
+
+	private:
+		// Messages are small and answered right away, so they are not held back to be coalesced.
+		void DisableDelay()
+		{
+			if (IsValid())
+			{
+				int noDelay = 1;
+				setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+			}
+		}
+
+		SocketHandle handle = invalidSocket;
+	};
+
+	// Builds a message payload from plain values and byte ranges.
+	class MessageWriter
+	{
+	public:
+		template<typename T>
+		MessageWriter& Put(const T& value)
+		{
+			return PutBytes(&value, sizeof(T));
+		}
+
+		MessageWriter& PutString(const std::string& text)
+		{
+			Put(static_cast<uint32_t>(text.size()));
+			return PutBytes(text.data(), text.size());
+		}
+
+		MessageWriter& PutBytes(const void* data, size_t bytes)
+		{
+			const char* begin = static_cast<const char*>(data);
+			payload.insert(payload.end(), begin, begin + bytes);
+			return *this;
+		}
+
+		const std::vector<char>& Payload() const
+		{
+			return payload;
+		}
+
+	private:
+		std::vector<char> payload;
+	};
+
+	// Reads values back in the order they were put. Reading past the end fails and leaves the value unchanged.
+	class MessageReader
+	{
+	public:
+		explicit MessageReader(const std::vector<char>& payload) : payload(payload) {}
+
+		template<typename T>
+		bool Get(T& value)
+		{
+			return GetBytes(&value, sizeof(T));
+		}
+
+		bool GetString(std::string& text)
+		{
+			uint32_t length = 0;
+			if (!Get(length) || length > payload.size() - position)
+			{
+				return false;
+			}
+			text.assign(payload.data() + position, length);
+			position += length;
+			return true;
+		}
+
+		bool GetBytes(void* data, size_t bytes)
+		{
+			if (bytes > payload.size() - position)
+			{
+				return false;
+			}
+			std::memcpy(data, payload.data() + position, bytes);
+			position += bytes;
+			return true;
+		}
+
+	private:
+		const std::vector<char>& payload;
+		size_t position = 0;
+	};
+
+	// Messages are a 32-bit type and a 64-bit payload size followed by the payload.
+	inline bool SendMessage(Socket& socket, uint32_t type, const std::vector<char>& payload)
+	{
+		const uint64_t size = payload.size();
+		return socket.SendAll(&type, sizeof(type)) && socket.SendAll(&size, sizeof(size)) && (size == 0 || socket.SendAll(payload.data(), payload.size()));
+	}
+
+	// Larger payloads than maxSize fail before anything is allocated, so every receiver bounds what a peer can
+	// make it allocate by the largest message it expects.
+	inline bool ReceiveMessage(Socket& socket, uint32_t& type, std::vector<char>& payload, uint64_t maxSize)
+	{
+		uint64_t size = 0;
+		if (!socket.ReceiveAll(&type, sizeof(type)) || !socket.ReceiveAll(&size, sizeof(size)) || size > maxSize)
+		{
+			return false;
+		}
+		payload.resize(static_cast<size_t>(size));
+		return size == 0 || socket.ReceiveAll(payload.data(), payload.size());
+	}
+}
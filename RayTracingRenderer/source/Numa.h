@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Processor topology and thread placement. Everything degrades to a single node holding all CPUs,
+// and to no-ops, where the platform gives no information.
+namespace rtr::numa
+{
+	namespace detail
+	{
+		// Parses a Linux CPU list such as "0-3,8-11".
+		inline std::vector<int> ParseCpuList(const std::string& list)
+		{
+			std::vector<int> cpus;
+			size_t position = 0;
+			while (position < list.size())
+			{
+				size_t end = list.find(',', position);
+				end = end == std::string::npos ? list.size() : end;
+				const std::string range = list.substr(position, end - position);
+				const size_t dash = range.find('-');
+				try
+				{
+					int first = std::stoi(range.substr(0, dash));
+					int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+					for (int cpu = first; cpu <= last; cpu++)
+					{
+						cpus.push_back(cpu);
+					}
+				}
+				catch (...)
+				{
+				}
+				position = end + 1;
+			}
+			return cpus;
+		}
+
+		inline std::vector<std::vector<int>> DetectNodes()
+		{
+			std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+			for (int node = 0; node < 1024; node++)
+			{
+				std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+				if (!file)
+				{
+					// Node numbers may have holes, stop after a long run of missing ones.
+					if (node > 64 && nodes.size() > 0)
+					{
+						break;
+					}
+					continue;
+				}
+				std::string list;
+				std::getline(file, list);
+				auto cpus = ParseCpuList(list);
+				if (!cpus.empty())
+				{
+					nodes.push_back(cpus);
+				}
+			}
+#elif defined(_WIN32)
+			ULONG highestNode = 0;
+			if (GetNumaHighestNodeNumber(&highestNode))
+			{
+				for (ULONG node = 0; node <= highestNode; node++)
+				{
+					ULONGLONG mask = 0;
+					if (!GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask))
+					{
+						continue;
+					}
+					std::vector<int> cpus;
+					for (int cpu = 0; cpu < 64; cpu++)
+					{
+						if (mask & (1ULL << cpu))
+						{
+							cpus.push_back(cpu);
+						}
+					}
+					if (!cpus.empty())
+					{
+						nodes.push_back(cpus);
+					}
+				}
+			}
+#endif
+			if (nodes.empty())
+			{
+				std::vector<int> cpus(std::max(1u, std::thread::hardware_concurrency()));
+				for (size_t cpu = 0; cpu < cpus.size(); cpu++)
+				{
+					cpus[cpu] = static_cast<int>(cpu);
+				}
+				nodes.push_back(cpus);
+			}
+			return nodes;
+		}
+	}
+
+	// Logical CPUs of every NUMA node.
+	inline const std::vector<std::vector<int>>& Nodes()
+	{
+		static const std::vector<std::vector<int>> nodes = detail::DetectNodes();
+		return nodes;
+	}
+
+	// All CPUs, node after node. Worker w runs on entry w, so consecutive workers share a node.
+	inline const std::vector<int>& CpusInNodeOrder()
+	{
+		static const std::vector<int> cpus = []()
+		{
+			std::vector<int> ordered;
+			for (const auto& node : Nodes())
+			{
+				ordered.insert(ordered.end(), node.begin(), node.end());
+			}
+			return ordered;
+		}();
+		return cpus;
+	}
+
+	// Restricts the calling thread to the given CPUs; an empty list allows every CPU again.
+	inline bool PinCurrentThread(const std::vector<int>& cpus)
+	{
+		const std::vector<int>& allowed = cpus.empty() ? CpusInNodeOrder() : cpus;
+#if defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu : allowed)
+		{
+			CPU_SET(cpu, &set);
+		}
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+		DWORD_PTR mask = 0;
+		for (int cpu : allowed)
+		{
+			mask |= cpu < 64 ? DWORD_PTR(1) << cpu : 0;
+		}
+		return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+		return false;
+#endif
+	}
+
+	// Gives the whole pages inside [data, data + bytes) back to the system. Anonymous memory reads back as
+	// zeros and is placed again on the node of whichever thread writes it first. Only done on Linux.
+	inline void ReleasePages(void* data, size_t bytes)
+	{
+#if defined(__linux__)
+		const auto pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+		const auto begin = (reinterpret_cast<uintptr_t>(data) + pageSize - 1) & ~(pageSize - 1);
+		const auto end = (reinterpret_cast<uintptr_t>(data) + bytes) & ~(pageSize - 1);
+		if (end > begin)
+		{
+			madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+		}
+#endif
+	}
+}
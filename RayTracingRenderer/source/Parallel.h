@@ -0,0 +1,245 @@
+#pragma once
+
+#include "Numa.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+
+// Threading backend, chosen at build time: define RTR_THREADING_OPENMP or RTR_THREADING_TBB to use
+// OpenMP or oneTBB, otherwise a built-in std::thread pool is used. The thread count is a run time argument.
+// Thread affinity is supported by the built-in pool and OpenMP; with TBB threads are never pinned.
+#if defined(RTR_THREADING_OPENMP)
+#include <omp.h>
+#elif defined(RTR_THREADING_TBB)
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#else
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#endif
+
+namespace rtr::parallel
+{
+	inline int DefaultThreadsCount()
+	{
+		return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	}
+
+	namespace detail
+	{
+		inline std::atomic<bool> threadAffinity = false;
+
+		// Pins or unpins the calling thread when the setting changed since its last task.
+		inline void ApplyAffinity(int participant, bool& pinned)
+		{
+			const bool enabled = threadAffinity.load(std::memory_order_relaxed);
+			if (enabled)
+			{
+				const auto& cpus = numa::CpusInNodeOrder();
+				numa::PinCurrentThread({ cpus[participant % cpus.size()] });
+			}
+			else if (pinned)
+			{
+				numa::PinCurrentThread({});
+			}
+			pinned = enabled;
+		}
+	}
+
+	// When enabled, participant p of every Run is pinned to CPU p in node order (the caller is participant 0),
+	// so the first tasks of a run, which participant p always executes itself, stay on one NUMA node.
+	inline void SetThreadAffinity(bool enabled)
+	{
+		detail::threadAffinity = enabled;
+	}
+
+#if !defined(RTR_THREADING_OPENMP) && !defined(RTR_THREADING_TBB)
+	// Persistent workers that grow on demand. One job runs at a time; the calling thread takes part in it.
+	// Participant p starts with task p, the remaining tasks are handed out by an atomic counter.
+	// Calls from inside a task run serially instead of deadlocking.
+	class ThreadPool
+	{
+	public:
+		ThreadPool() = default;
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (auto& worker : workers)
+			{
+				worker.join();
+			}
+		}
+
+		void Run(int tasksCount, int threadsCount, const std::function<void(int)>& task)
+		{
+			if (insideTask || threadsCount <= 1 || tasksCount <= 1)
+			{
+				for (int t = 0; t < tasksCount; t++)
+				{
+					task(t);
+				}
+				return;
+			}
+
+			std::lock_guard<std::mutex> runLock(runMutex);
+			const int helpers = std::min(threadsCount, tasksCount) - 1;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				while (static_cast<int>(workers.size()) < helpers)
+				{
+					workers.emplace_back(&ThreadPool::WorkerLoop, this, static_cast<int>(workers.size()));
+				}
+				job = &task;
+				jobTasksCount = tasksCount;
+				nextTask.store(helpers + 1, std::memory_order_relaxed);
+				helpersCount = helpers;
+				activeHelpers = helpers;
+				generation++;
+			}
+			wake.notify_all();
+
+			insideTask = true;
+			bool callerPinned = false;
+			detail::ApplyAffinity(0, callerPinned);
+			Work(0);
+			if (callerPinned)
+			{
+				numa::PinCurrentThread({});
+			}
+			insideTask = false;
+
+			std::unique_lock<std::mutex> lock(mutex);
+			done.wait(lock, [&]() { return activeHelpers == 0; });
+			job = nullptr;
+		}
+
+	private:
+		void WorkerLoop(int index)
+		{
+			insideTask = true;
+			bool pinned = false;
+			uint64_t seenGeneration = 0;
+			std::unique_lock<std::mutex> lock(mutex);
+			while (true)
+			{
+				wake.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+				if (stopping)
+				{
+					return;
+				}
+				seenGeneration = generation;
+				if (index >= helpersCount)
+				{
+					continue;
+				}
+
+				lock.unlock();
+				detail::ApplyAffinity(index + 1, pinned);
+				Work(index + 1);
+				lock.lock();
+				if (--activeHelpers == 0)
+				{
+					done.notify_all();
+				}
+			}
+		}
+
+		void Work(int participant)
+		{
+			(*job)(participant);
+			for (int t = nextTask.fetch_add(1, std::memory_order_relaxed); t < jobTasksCount; t = nextTask.fetch_add(1, std::memory_order_relaxed))
+			{
+				(*job)(t);
+			}
+		}
+
+		static inline thread_local bool insideTask = false;
+
+		std::vector<std::thread> workers;
+		std::mutex runMutex;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+		const std::function<void(int)>* job = nullptr;
+		int jobTasksCount = 0;
+		std::atomic<int> nextTask = 0;
+		int helpersCount = 0;
+		int activeHelpers = 0;
+		uint64_t generation = 0;
+		bool stopping = false;
+	};
+
+	inline ThreadPool& GlobalThreadPool()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+#endif
+
+	// Calls task(0) ... task(tasksCount - 1) on up to threadsCount threads, the caller included, and waits for all.
+	// Tasks may start in any order and need not run concurrently, so they must not wait for each other.
+	inline void Run(int tasksCount, int threadsCount, const std::function<void(int)>& task)
+	{
+		if (tasksCount <= 0)
+		{
+			return;
+		}
+
+#if defined(RTR_THREADING_OPENMP)
+#pragma omp parallel num_threads(std::max(1, std::min(threadsCount, tasksCount)))
+		{
+			static thread_local bool pinned = false;
+			detail::ApplyAffinity(omp_get_thread_num(), pinned);
+			// First the participant's own task, then the rest dynamically.
+#pragma omp for schedule(static, 1) nowait
+			for (int t = 0; t < std::min(omp_get_num_threads(), tasksCount); t++)
+			{
+				task(t);
+			}
+#pragma omp for schedule(dynamic, 1)
+			for (int t = omp_get_num_threads(); t < tasksCount; t++)
+			{
+				task(t);
+			}
+
+			// The caller's thread is not kept pinned after the run.
+			if (omp_get_thread_num() == 0 && pinned)
+			{
+				numa::PinCurrentThread({});
+				pinned = false;
+			}
+		}
+#elif defined(RTR_THREADING_TBB)
+		tbb::task_arena arena(std::max(1, threadsCount));
+		arena.execute([&]()
+			{
+				tbb::parallel_for(0, tasksCount, [&](int t) { task(t); });
+			});
+#else
+		GlobalThreadPool().Run(tasksCount, threadsCount, task);
+#endif
+	}
+
+	// Parallel loop over [begin, end) on up to threadsCount threads.
+	inline void For(int begin, int end, int threadsCount, const std::function<void(int)>& body)
+	{
+		Run(end - begin, threadsCount, [&](int t) { body(begin + t); });
+	}
+
+	// Parallel loop over [begin, end) on all hardware threads.
+	inline void For(int begin, int end, const std::function<void(int)>& body)
+	{
+		For(begin, end, DefaultThreadsCount(), body);
+	}
+}
@@ -0,0 +1,339 @@
+#pragma once
+
+#include "Color.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace rtr
+{
+	// Samples [sampleOffset, sampleOffset + samplesPerPixel) of every pixel drawn with seed. Runs with the same
+	// seed and disjoint ranges add up to one larger run, up to floating-point summation order; runs with
+	// different seeds are independent.
+	struct SampleRun
+	{
+		uint64_t seed = 0;
+		int32_t sampleOffset = 0;
+		int32_t samplesPerPixel = 0;
+	};
+
+	// Linear, unclamped per-pixel sums in double precision with sample counts, rows from the top of the image,
+	// and the runs they hold. Adding buffers (in memory or as files, see MergePartialSamples) adds the samples.
+	class PartialSampleBuffer
+	{
+	public:
+		PartialSampleBuffer(int width, int height)
+			: width(width), height(height), sums(static_cast<size_t>(width) * height * 3, 0.0), squaredLuminanceSums(static_cast<size_t>(width) * height, 0.0),
+			sampleCounts(static_cast<size_t>(width) * height, 0)
+		{
+		}
+
+		int Width() const
+		{
+			return width;
+		}
+
+		int Height() const
+		{
+			return height;
+		}
+
+		// Each pixel is added to by one thread only.
+		void Add(int x, int y, const Color& sampleSum, double squaredLuminanceSum, int samplesCount)
+		{
+			const size_t index = static_cast<size_t>(y) * width + x;
+			sums[index * 3] += sampleSum.R();
+			sums[index * 3 + 1] += sampleSum.G();
+			sums[index * 3 + 2] += sampleSum.B();
+			squaredLuminanceSums[index] += squaredLuminanceSum;
+			sampleCounts[index] += samplesCount;
+		}
+
+		uint32_t SampleCount(int x, int y) const
+		{
+			return sampleCounts[static_cast<size_t>(y) * width + x];
+		}
+
+		Color Sum(int x, int y) const
+		{
+			const size_t index = static_cast<size_t>(y) * width + x;
+			return Color(sums[index * 3], sums[index * 3 + 1], sums[index * 3 + 2]);
+		}
+
+		std::vector<SampleRun>& Runs()
+		{
+			return runs;
+		}
+
+		const std::vector<SampleRun>& Runs() const
+		{
+			return runs;
+		}
+
+		std::string& Sampler()
+		{
+			return sampler;
+		}
+
+		const std::string& Sampler() const
+		{
+			return sampler;
+		}
+
+		// Row y in the file layout: sums, squared luminance sums, counts.
+		void WriteRow(std::ostream& stream, int y) const
+		{
+			const size_t row = static_cast<size_t>(y) * width;
+			stream.write(reinterpret_cast<const char*>(sums.data() + row * 3), static_cast<size_t>(width) * 3 * sizeof(double));
+			stream.write(reinterpret_cast<const char*>(squaredLuminanceSums.data() + row), static_cast<size_t>(width) * sizeof(double));
+			stream.write(reinterpret_cast<const char*>(sampleCounts.data() + row), static_cast<size_t>(width) * sizeof(uint32_t));
+		}
+
+	private:
+		int width;
+		int height;
+		std::vector<double> sums;
+		std::vector<double> squaredLuminanceSums;
+		std::vector<uint32_t> sampleCounts;
+		std::vector<SampleRun> runs;
+		std::string sampler; // Sampler::Name of the runs; only runs of the same sampler can be merged.
+	};
+
+	namespace detail
+	{
+		inline constexpr uint32_t partialSamplesMagic = 0x31505452; // "RTP1"
+
+		struct PartialSamplesHeader
+		{
+			int32_t width = 0;
+			int32_t height = 0;
+			std::vector<SampleRun> runs;
+			std::string sampler;
+		};
+
+		inline void WritePartialSamplesHeader(std::ostream& stream, const PartialSamplesHeader& header)
+		{
+			const uint32_t runsCount = static_cast<uint32_t>(header.runs.size());
+			const uint32_t samplerLength = static_cast<uint32_t>(header.sampler.size());
+			stream.write(reinterpret_cast<const char*>(&partialSamplesMagic), sizeof(partialSamplesMagic));
+			stream.write(reinterpret_cast<const char*>(&header.width), sizeof(header.width));
+			stream.write(reinterpret_cast<const char*>(&header.height), sizeof(header.height));
+			stream.write(reinterpret_cast<const char*>(&runsCount), sizeof(runsCount));
+			for (const auto& run : header.runs)
+			{
+				stream.write(reinterpret_cast<const char*>(&run.seed), sizeof(run.seed));
+				stream.write(reinterpret_cast<const char*>(&run.sampleOffset), sizeof(run.sampleOffset));
+				stream.write(reinterpret_cast<const char*>(&run.samplesPerPixel), sizeof(run.samplesPerPixel));
+			}
+			stream.write(reinterpret_cast<const char*>(&samplerLength), sizeof(samplerLength));
+			stream.write(header.sampler.data(), samplerLength);
+		}
+
+		inline bool ReadPartialSamplesHeader(std::istream& stream, PartialSamplesHeader& header)
+		{
+			uint32_t magic = 0, runsCount = 0, samplerLength = 0;
+			stream.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+			stream.read(reinterpret_cast<char*>(&header.width), sizeof(header.width));
+			stream.read(reinterpret_cast<char*>(&header.height), sizeof(header.height));
+			stream.read(reinterpret_cast<char*>(&runsCount), sizeof(runsCount));
+			if (!stream || magic != partialSamplesMagic || header.width <= 0 || header.height <= 0 || runsCount > (1u << 20))
+			{
+				return false;
+			}
+			header.runs.resize(runsCount);
+			for (auto& run : header.runs)
+			{
+				stream.read(reinterpret_cast<char*>(&run.seed), sizeof(run.seed));
+				stream.read(reinterpret_cast<char*>(&run.sampleOffset), sizeof(run.sampleOffset));
+				stream.read(reinterpret_cast<char*>(&run.samplesPerPixel), sizeof(run.samplesPerPixel));
+			}
+			stream.read(reinterpret_cast<char*>(&samplerLength), sizeof(samplerLength));
+			if (!stream || samplerLength > 4096)
+			{
+				return false;
+			}
+			header.sampler.resize(samplerLength);
+			stream.read(header.sampler.data(), samplerLength);
+			return static_cast<bool>(stream);
+		}
+
+		inline size_t PartialSamplesRowBytes(int width)
+		{
+			return static_cast<size_t>(width) * (4 * sizeof(double) + sizeof(uint32_t));
+		}
+
+		// Samples of the same seed and index would be counted twice.
+		inline bool RunsOverlap(const SampleRun& a, const SampleRun& b)
+		{
+			return a.seed == b.seed && a.sampleOffset < b.sampleOffset + b.samplesPerPixel && b.sampleOffset < a.sampleOffset + a.samplesPerPixel;
+		}
+	}
+
+	inline bool WritePartialSamples(const std::string& fileName, const PartialSampleBuffer& buffer)
+	{
+		std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+		detail::WritePartialSamplesHeader(file, { buffer.Width(), buffer.Height(), buffer.Runs(), buffer.Sampler() });
+		for (int y = 0; y < buffer.Height(); y++)
+		{
+			buffer.WriteRow(file, y);
+		}
+		return static_cast<bool>(file.flush());
+	}
+
+	// Adds the partial sample files into one, reading and writing one row at a time, so memory stays at a row
+	// per input whatever the image size. Inputs must have the same size and sampler and no run whose samples
+	// another input already holds, and none of them may be the output. Per-file sums are added in another order
+	// than one run adds its samples, so the result equals such a run only up to rounding. On failure the output
+	// is left untouched and error, when given, says why.
+	inline bool MergePartialSamples(const std::vector<std::string>& inputFileNames, const std::string& outputFileName, std::string* error = nullptr)
+	{
+		auto fail = [&](const std::string& message)
+		{
+			if (error != nullptr)
+			{
+				*error = message;
+			}
+			return false;
+		};
+
+		if (inputFileNames.empty())
+		{
+			return fail("No inputs");
+		}
+		for (const auto& fileName : inputFileNames)
+		{
+			std::error_code equivalentError;
+			if (std::filesystem::equivalent(fileName, outputFileName, equivalentError))
+			{
+				return fail("The output " + outputFileName + " is also an input");
+			}
+		}
+		std::vector<std::unique_ptr<std::ifstream>> inputs;
+		detail::PartialSamplesHeader merged;
+		for (const auto& fileName : inputFileNames)
+		{
+			inputs.push_back(std::make_unique<std::ifstream>(fileName, std::ios::binary));
+			detail::PartialSamplesHeader header;
+			if (!*inputs.back() || !detail::ReadPartialSamplesHeader(*inputs.back(), header))
+			{
+				return fail("Cannot read " + fileName);
+			}
+			if (inputs.size() == 1)
+			{
+				merged.width = header.width;
+				merged.height = header.height;
+				merged.sampler = header.sampler;
+			}
+			else if (header.width != merged.width || header.height != merged.height || header.sampler != merged.sampler)
+			{
+				return fail(fileName + " has a different size or sampler");
+			}
+			for (const auto& run : header.runs)
+			{
+				for (const auto& mergedRun : merged.runs)
+				{
+					if (detail::RunsOverlap(run, mergedRun))
+					{
+						return fail(fileName + " repeats samples of seed " + std::to_string(run.seed));
+					}
+				}
+			}
+			merged.runs.insert(merged.runs.end(), header.runs.begin(), header.runs.end());
+		}
+
+		// Written next to the output and renamed over it once complete, so a failed merge leaves the output as it was.
+		const std::string temporaryFileName = outputFileName + ".tmp";
+		bool written = false;
+		{
+			std::ofstream output(temporaryFileName, std::ios::binary | std::ios::trunc);
+			detail::WritePartialSamplesHeader(output, merged);
+
+			const size_t width = static_cast<size_t>(merged.width);
+			std::vector<char> row(detail::PartialSamplesRowBytes(merged.width));
+			std::vector<double> rowSums(width * 4);
+			std::vector<uint32_t> rowCounts(width);
+			bool complete = true;
+			for (int y = 0; y < merged.height && complete; y++)
+			{
+				std::fill(rowSums.begin(), rowSums.end(), 0.0);
+				std::fill(rowCounts.begin(), rowCounts.end(), 0u);
+				for (auto& input : inputs)
+				{
+					if (!input->read(row.data(), row.size()))
+					{
+						complete = false;
+						break;
+					}
+					const auto* sums = reinterpret_cast<const double*>(row.data());
+					const auto* counts = reinterpret_cast<const uint32_t*>(row.data() + width * 4 * sizeof(double));
+					for (size_t v = 0; v < width * 4; v++)
+					{
+						rowSums[v] += sums[v];
+					}
+					for (size_t x = 0; x < width; x++)
+					{
+						rowCounts[x] += counts[x];
+					}
+				}
+				output.write(reinterpret_cast<const char*>(rowSums.data()), rowSums.size() * sizeof(double));
+				output.write(reinterpret_cast<const char*>(rowCounts.data()), rowCounts.size() * sizeof(uint32_t));
+			}
+			written = complete && output.flush();
+		}
+		std::error_code fileError;
+		if (!written)
+		{
+			std::filesystem::remove(temporaryFileName, fileError);
+			return fail("An input ended early or the output could not be written");
+		}
+		std::filesystem::rename(temporaryFileName, outputFileName, fileError);
+		return fileError ? fail("Cannot replace " + outputFileName) : true;
+	}
+
+	// Gamma corrected, clamped mean of every pixel of a partial sample file in the RGB layout of the render
+	// buffers, read row by row.
+	inline bool ResolvePartialSamples(const std::string& fileName, std::vector<float>& imageOutBuffer, int& imageWidth, int& imageHeight)
+	{
+		std::ifstream file(fileName, std::ios::binary);
+		detail::PartialSamplesHeader header;
+		if (!file || !detail::ReadPartialSamplesHeader(file, header))
+		{
+			return false;
+		}
+		imageWidth = header.width;
+		imageHeight = header.height;
+		imageOutBuffer.resize(static_cast<size_t>(imageWidth) * imageHeight * 3);
+
+		const size_t width = static_cast<size_t>(imageWidth);
+		std::vector<char> row(detail::PartialSamplesRowBytes(imageWidth));
+		for (int y = 0; y < imageHeight; y++)
+		{
+			if (!file.read(row.data(), row.size()))
+			{
+				return false;
+			}
+			const auto* sums = reinterpret_cast<const double*>(row.data());
+			const auto* counts = reinterpret_cast<const uint32_t*>(row.data() + width * 4 * sizeof(double));
+			for (size_t x = 0; x < width; x++)
+			{
+				Color pixelColor(sums[x * 3], sums[x * 3 + 1], sums[x * 3 + 2]);
+				if (counts[x] > 0)
+				{
+					pixelColor.Normalize(counts[x]);
+				}
+				pixelColor.CorrectGamma();
+				const size_t index = (y * width + x) * 3;
+				imageOutBuffer[index] = static_cast<float>(pixelColor.R());
+				imageOutBuffer[index + 1] = static_cast<float>(pixelColor.G());
+				imageOutBuffer[index + 2] = static_cast<float>(pixelColor.B());
+			}
+		}
+		return true;
+	}
+}
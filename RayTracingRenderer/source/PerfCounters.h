@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+// Hardware counters of the whole process through perf_event_open, Linux only. Everywhere else, and where the
+// kernel or a virtual machine does not expose the events (see /proc/sys/kernel/perf_event_paranoid), the
+// counters are unavailable and read as zero.
+namespace rtr::perf
+{
+	// References to and misses of the last level cache (the generic hardware cache events). References include
+	// prefetches into the last level, so they only approximate the misses of the level above it.
+	class CacheCounters
+	{
+	public:
+		// Counts every thread that exists now and, through inheritance, the threads they create later.
+		CacheCounters()
+		{
+#if defined(__linux__)
+			DIR* tasks = opendir("/proc/self/task");
+			if (tasks == nullptr)
+			{
+				return;
+			}
+			while (dirent* entry = readdir(tasks))
+			{
+				if (entry->d_name[0] == '.')
+				{
+					continue;
+				}
+				const int thread = std::stoi(entry->d_name);
+				const int references = Open(thread, PERF_COUNT_HW_CACHE_REFERENCES);
+				const int misses = Open(thread, PERF_COUNT_HW_CACHE_MISSES);
+				if (references < 0 || misses < 0)
+				{
+					Close(references);
+					Close(misses);
+					available = false;
+					break;
+				}
+				referenceCounters.push_back(references);
+				missCounters.push_back(misses);
+				available = true;
+			}
+			closedir(tasks);
+			if (!available)
+			{
+				CloseAll();
+			}
+#endif
+		}
+
+		CacheCounters(const CacheCounters&) = delete;
+		CacheCounters& operator=(const CacheCounters&) = delete;
+
+		~CacheCounters()
+		{
+			CloseAll();
+		}
+
+		bool Available() const
+		{
+			return available;
+		}
+
+		void Start()
+		{
+			Control(referenceCounters, true);
+			Control(missCounters, true);
+		}
+
+		void Stop()
+		{
+			Control(referenceCounters, false);
+			Control(missCounters, false);
+		}
+
+		uint64_t LastLevelCacheReferences() const
+		{
+			return Sum(referenceCounters);
+		}
+
+		uint64_t LastLevelCacheMisses() const
+		{
+			return Sum(missCounters);
+		}
+
+	private:
+#if defined(__linux__)
+		static int Open(int thread, uint64_t event)
+		{
+			perf_event_attr attributes;
+			std::memset(&attributes, 0, sizeof(attributes));
+			attributes.size = sizeof(attributes);
+			attributes.type = PERF_TYPE_HARDWARE;
+			attributes.config = event;
+			attributes.disabled = 1;
+			attributes.inherit = 1;
+			attributes.exclude_kernel = 1;
+			attributes.exclude_hv = 1;
+			return static_cast<int>(syscall(SYS_perf_event_open, &attributes, thread, -1, -1, 0));
+		}
+
+		static void Close(int counter)
+		{
+			if (counter >= 0)
+			{
+				close(counter);
+			}
+		}
+#endif
+
+		static void Control(const std::vector<int>& counters, bool enable)
+		{
+#if defined(__linux__)
+			for (int counter : counters)
+			{
+				if (enable)
+				{
+					ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+				}
+				ioctl(counter, enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+			}
+#endif
+		}
+
+		static uint64_t Sum(const std::vector<int>& counters)
+		{
+			uint64_t sum = 0;
+#if defined(__linux__)
+			for (int counter : counters)
+			{
+				uint64_t value = 0;
+				if (read(counter, &value, sizeof(value)) == sizeof(value))
+				{
+					sum += value;
+				}
+			}
+#endif
+			return sum;
+		}
+
+		void CloseAll()
+		{
+#if defined(__linux__)
+			for (int counter : referenceCounters)
+			{
+				Close(counter);
+			}
+			for (int counter : missCounters)
+			{
+				Close(counter);
+			}
+#endif
+			referenceCounters.clear();
+			missCounters.clear();
+		}
+
+		bool available = false;
+		std::vector<int> referenceCounters;
+		std::vector<int> missCounters;
+	};
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include "Constants.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace rtr
+{
+	// 64-bit finalizer (splitmix64), spreads nearby inputs over the whole range.
+	inline uint64_t MixBits(uint64_t v)
+	{
+		v ^= v >> 31;
+		v *= 0x7fb5d329728ea185ULL;
+		v ^= v >> 27;
+		v *= 0x81dadef4bc2dd44dULL;
+		v ^= v >> 33;
+		return v;
+	}
+
+	inline uint64_t Hash(uint64_t a, uint64_t b)
+	{
+		return MixBits(a ^ MixBits(b + 0x9e3779b97f4a7c15ULL));
+	}
+
+	template <typename... Args>
+	inline uint64_t Hash(uint64_t a, uint64_t b, Args... rest)
+	{
+		return Hash(Hash(a, b), static_cast<uint64_t>(rest)...);
+	}
+
+	// PCG32 generator (O'Neill 2014): 64-bit LCG state with a permuted 32-bit output.
+	// Small enough to create one per task instead of sharing global state between threads.
+	class Random
+	{
+	public:
+		Random() : state(defaultState), increment(defaultStream) {}
+
+		Random(uint64_t seed, uint64_t stream = 1)
+		{
+			SetSequence(seed, stream);
+		}
+
+		void SetSequence(uint64_t seed, uint64_t stream)
+		{
+			state = 0;
+			increment = (stream << 1) | 1;
+			NextUInt();
+			state += seed;
+			NextUInt();
+		}
+
+		uint32_t NextUInt()
+		{
+			uint64_t oldState = state;
+			state = oldState * multiplier + increment;
+			return Output(oldState);
+		}
+
+		double NextDouble()
+		{
+			// Random double in [0,1).
+			return ToDouble(NextUInt());
+		}
+
+		float NextFloat()
+		{
+			// Random float in [0,1).
+			return ToFloat(NextUInt());
+		}
+
+		// Jumps delta steps ahead (or back) in the sequence in O(log delta).
+		void Advance(int64_t delta)
+		{
+			uint64_t jumpMultiplier, jumpIncrement;
+			JumpCoefficients(static_cast<uint64_t>(delta), increment, jumpMultiplier, jumpIncrement);
+			state = jumpMultiplier * state + jumpIncrement;
+		}
+
+	private:
+		template <int Lanes>
+		friend class RandomBatch;
+
+		static uint32_t Output(uint64_t oldState)
+		{
+			uint32_t xorShifted = static_cast<uint32_t>(((oldState >> 18) ^ oldState) >> 27);
+			uint32_t rotation = static_cast<uint32_t>(oldState >> 59);
+			return (xorShifted >> rotation) | (xorShifted << ((~rotation + 1) & 31));
+		}
+
+		static double ToDouble(uint32_t value)
+		{
+			return std::min(value * 0x1p-32, consts::oneMinusEpsilon);
+		}
+
+		static float ToFloat(uint32_t value)
+		{
+			return std::min(value * 0x1p-32f, 0x1.fffffep-1f);
+		}
+
+		// Affine map state -> jumpMultiplier * state + jumpIncrement of the given number of LCG steps.
+		static void JumpCoefficients(uint64_t steps, uint64_t stepIncrement, uint64_t& jumpMultiplier, uint64_t& jumpIncrement)
+		{
+			uint64_t currentMultiplier = multiplier;
+			uint64_t currentIncrement = stepIncrement;
+			jumpMultiplier = 1;
+			jumpIncrement = 0;
+			while (steps > 0)
+			{
+				if (steps & 1)
+				{
+					jumpMultiplier *= currentMultiplier;
+					jumpIncrement = jumpIncrement * currentMultiplier + currentIncrement;
+				}
+				currentIncrement = (currentMultiplier + 1) * currentIncrement;
+				currentMultiplier *= currentMultiplier;
+				steps /= 2;
+			}
+		}
+
+		static constexpr uint64_t multiplier = 0x5851f42d4c957f2dULL;
+		static constexpr uint64_t defaultState = 0x853c49e6748fea9bULL;
+		static constexpr uint64_t defaultStream = 0xda3e39cb94b95bdbULL;
+
+		uint64_t state;
+		uint64_t increment;
+	};
+
+	// The stream of a Random generator, Lanes values at a time. Lane k holds the state k steps ahead and
+	// every lane jumps Lanes steps per batch, so batches concatenate to exactly the scalar sequence.
+	// The lane loops are free of dependencies between lanes, which lets the compiler vectorize them.
+	template <int Lanes>
+	class RandomBatch
+	{
+	public:
+		explicit RandomBatch(const Random& random) : increment(random.increment)
+		{
+			Random::JumpCoefficients(Lanes, increment, strideMultiplier, strideIncrement);
+			SetLanes(random.state);
+		}
+
+		void NextUInts(uint32_t* values)
+		{
+			for (int lane = 0; lane < Lanes; lane++)
+			{
+				values[lane] = Random::Output(states[lane]);
+				states[lane] = states[lane] * strideMultiplier + strideIncrement;
+			}
+		}
+
+		void NextDoubles(double* values)
+		{
+			uint32_t bits[Lanes];
+			NextUInts(bits);
+			for (int lane = 0; lane < Lanes; lane++)
+			{
+				values[lane] = Random::ToDouble(bits[lane]);
+			}
+		}
+
+		void NextFloats(float* values)
+		{
+			uint32_t bits[Lanes];
+			NextUInts(bits);
+			for (int lane = 0; lane < Lanes; lane++)
+			{
+				values[lane] = Random::ToFloat(bits[lane]);
+			}
+		}
+
+		// Any count is allowed; after a partial batch the lanes are realigned to the next value of the stream.
+		void Fill(float* values, size_t count)
+		{
+			size_t i = 0;
+			for (; i + Lanes <= count; i += Lanes)
+			{
+				NextFloats(values + i);
+			}
+
+			const size_t remaining = count - i;
+			if (remaining > 0)
+			{
+				for (size_t lane = 0; lane < remaining; lane++)
+				{
+					values[i + lane] = Random::ToFloat(Random::Output(states[lane]));
+				}
+				SetLanes(states[remaining - 1] * Random::multiplier + increment);
+			}
+		}
+
+		// Scalar generator continuing where the batches stopped.
+		Random Scalar() const
+		{
+			Random random;
+			random.state = states[0];
+			random.increment = increment;
+			return random;
+		}
+
+	private:
+		void SetLanes(uint64_t firstState)
+		{
+			states[0] = firstState;
+			for (int lane = 1; lane < Lanes; lane++)
+			{
+				states[lane] = states[lane - 1] * Random::multiplier + increment;
+			}
+		}
+
+		uint64_t states[Lanes];
+		uint64_t increment;
+		uint64_t strideMultiplier;
+		uint64_t strideIncrement;
+	};
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "AccumulationBuffer.h"
+#include "TileScheduler.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace rtr
+{
+	// Cancel, pause and resume requests for a render. Workers check them before starting a tile, so the tiles in
+	// flight always finish and the buffers never hold half a tile. Safe to use from any thread.
+	class RenderControl
+	{
+	public:
+		void Cancel()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				cancelled = true;
+			}
+			resumed.notify_all();
+		}
+
+		void Pause()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			paused = true;
+		}
+
+		void Resume()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				paused = false;
+			}
+			resumed.notify_all();
+		}
+
+		bool IsCancelled() const
+		{
+			return cancelled.load(std::memory_order_relaxed);
+		}
+
+		bool IsPaused() const
+		{
+			return paused.load(std::memory_order_relaxed);
+		}
+
+		// Called by workers at tile boundaries. Blocks while paused, returns true when the render is cancelled.
+		bool ShouldStop()
+		{
+			if (paused.load(std::memory_order_relaxed))
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				resumed.wait(lock, [this]() { return !paused || cancelled; });
+			}
+			return cancelled.load(std::memory_order_relaxed);
+		}
+
+	private:
+		std::atomic<bool> cancelled = false;
+		std::atomic<bool> paused = false;
+		std::mutex mutex;
+		std::condition_variable resumed;
+	};
+
+	// What a render left behind when it finished or was cancelled. Pixels of one tile always have the same
+	// sample count, so the regions are the tiles.
+	struct PartialRender
+	{
+		AccumulationBuffer accumulation;             // Linear sums and per-pixel sample counts.
+		std::vector<Tile> regions;
+		std::vector<uint32_t> regionSamplesPerPixel; // Fewest samples of any pixel in each region.
+		bool completed = false;
+	};
+
+	// A render running on its own thread. Destroying the handle cancels the render and waits for it.
+	class RenderHandle
+	{
+	public:
+		RenderHandle(std::shared_ptr<RenderControl> renderControl, std::function<PartialRender()> render)
+			: control(std::move(renderControl)), state(std::make_shared<State>())
+		{
+			thread = std::thread([state = state, render = std::move(render)]()
+				{
+					PartialRender result = render();
+					std::lock_guard<std::mutex> lock(state->mutex);
+					state->result = std::make_unique<PartialRender>(std::move(result));
+				});
+		}
+
+		RenderHandle(RenderHandle&&) = default;
+
+		~RenderHandle()
+		{
+			if (thread.joinable())
+			{
+				control->Cancel();
+				thread.join();
+			}
+		}
+
+		void Cancel()
+		{
+			control->Cancel();
+		}
+
+		void Pause()
+		{
+			control->Pause();
+		}
+
+		void Resume()
+		{
+			control->Resume();
+		}
+
+		bool IsFinished() const
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			return state->result != nullptr;
+		}
+
+		// Waits for the render to finish or stop after a cancel and returns its buffers. Call it once.
+		PartialRender Wait()
+		{
+			thread.join();
+			return std::move(*state->result);
+		}
+
+	private:
+		struct State
+		{
+			mutable std::mutex mutex;
+			std::unique_ptr<PartialRender> result;
+		};
+
+		std::shared_ptr<RenderControl> control;
+		std::shared_ptr<State> state;
+		std::thread thread;
+	};
+}
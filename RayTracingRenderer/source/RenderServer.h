@@ -0,0 +1,448 @@
+#pragma once
+
+#include "Camera.h"
+#include "Distributed.h"
+#include "Image.h"
+#include "Network.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "Statistics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace rtr
+{
+	struct RenderRequest
+	{
+		std::string scene;
+		CameraSettings camera;
+		int32_t imageWidth = 0;
+		int32_t imageHeight = 0;
+		int32_t samplesPerPixel = 1;
+		int32_t maxDepth = 50;
+		bool denoise = true;
+		bool returnImage = true;
+		std::string outputPath; // Saved by the server when not empty.
+	};
+
+	struct RenderResponse
+	{
+		bool ok = false;
+		std::string error;
+		int32_t queueDepth = 0; // Jobs queued or rendering when this one was submitted.
+		double queueMs = 0.0;
+		double renderMs = 0.0;  // Rendering, denoising and saving.
+		double latencyMs = 0.0; // Submission to completion, as seen by the server.
+		int32_t imageWidth = 0;
+		int32_t imageHeight = 0;
+		std::vector<float> image; // Gamma corrected RGB rows from the top, when requested.
+	};
+
+	struct ServerStats
+	{
+		int64_t jobsDone = 0;
+		int32_t queueDepth = 0;     // Queued or rendering right now.
+		int32_t maxQueueDepth = 0;
+		int32_t scenesLoaded = 0;
+		double latencyP50Ms = 0.0;  // Over the most recent jobs.
+		double latencyP90Ms = 0.0;
+		double latencyP99Ms = 0.0;
+		double renderP50Ms = 0.0;
+	};
+
+	namespace detail
+	{
+		// Largest request, stats or shutdown message; names and paths are short.
+		inline constexpr uint64_t maxRequestBytes = 64 * 1024;
+
+		enum ServerMessageType : uint32_t
+		{
+			renderRequestMessage = 16,
+			renderResponseMessage,
+			statsRequestMessage,
+			statsResponseMessage,
+			shutdownRequestMessage
+		};
+
+		inline std::vector<char> RequestPayload(const RenderRequest& request)
+		{
+			net::MessageWriter writer;
+			writer.PutString(request.scene);
+			writer.Put(request.camera.position).Put(request.camera.lookAt).Put(request.camera.viewUp);
+			writer.Put(request.camera.vFov).Put(request.camera.aspectRatio).Put(request.camera.aperture).Put(request.camera.focusDistance);
+			writer.Put(request.imageWidth).Put(request.imageHeight).Put(request.samplesPerPixel).Put(request.maxDepth);
+			writer.Put(static_cast<uint8_t>(request.denoise)).Put(static_cast<uint8_t>(request.returnImage)).PutString(request.outputPath);
+			return writer.Payload();
+		}
+
+		inline bool ReadRequest(const std::vector<char>& payload, RenderRequest& request)
+		{
+			net::MessageReader reader(payload);
+			uint8_t denoise = 0, returnImage = 0;
+			const bool read = reader.GetString(request.scene)
+				&& reader.Get(request.camera.position) && reader.Get(request.camera.lookAt) && reader.Get(request.camera.viewUp)
+				&& reader.Get(request.camera.vFov) && reader.Get(request.camera.aspectRatio) && reader.Get(request.camera.aperture) && reader.Get(request.camera.focusDistance)
+				&& reader.Get(request.imageWidth) && reader.Get(request.imageHeight) && reader.Get(request.samplesPerPixel) && reader.Get(request.maxDepth)
+				&& reader.Get(denoise) && reader.Get(returnImage) && reader.GetString(request.outputPath);
+			request.denoise = denoise != 0;
+			request.returnImage = returnImage != 0;
+			return read;
+		}
+
+		inline std::vector<char> ResponsePayload(const RenderResponse& response)
+		{
+			net::MessageWriter writer;
+			writer.Put(static_cast<uint8_t>(response.ok)).PutString(response.error).Put(response.queueDepth);
+			writer.Put(response.queueMs).Put(response.renderMs).Put(response.latencyMs).Put(response.imageWidth).Put(response.imageHeight);
+			writer.Put(static_cast<uint64_t>(response.image.size())).PutBytes(response.image.data(), response.image.size() * sizeof(float));
+			return writer.Payload();
+		}
+
+		inline bool ReadResponse(const std::vector<char>& payload, RenderResponse& response)
+		{
+			net::MessageReader reader(payload);
+			uint8_t ok = 0;
+			uint64_t imageSize = 0;
+			if (!reader.Get(ok) || !reader.GetString(response.error) || !reader.Get(response.queueDepth) || !reader.Get(response.queueMs) || !reader.Get(response.renderMs)
+				|| !reader.Get(response.latencyMs) || !reader.Get(response.imageWidth) || !reader.Get(response.imageHeight) || !reader.Get(imageSize)
+				|| imageSize > payload.size() / sizeof(float))
+			{
+				return false;
+			}
+			response.ok = ok != 0;
+			response.image.resize(static_cast<size_t>(imageSize));
+			return reader.GetBytes(response.image.data(), response.image.size() * sizeof(float));
+		}
+
+		inline std::vector<char> StatsPayload(const ServerStats& stats)
+		{
+			net::MessageWriter writer;
+			writer.Put(stats.jobsDone).Put(stats.queueDepth).Put(stats.maxQueueDepth).Put(stats.scenesLoaded);
+			writer.Put(stats.latencyP50Ms).Put(stats.latencyP90Ms).Put(stats.latencyP99Ms).Put(stats.renderP50Ms);
+			return writer.Payload();
+		}
+
+		inline bool ReadStats(const std::vector<char>& payload, ServerStats& stats)
+		{
+			net::MessageReader reader(payload);
+			return reader.Get(stats.jobsDone) && reader.Get(stats.queueDepth) && reader.Get(stats.maxQueueDepth) && reader.Get(stats.scenesLoaded)
+				&& reader.Get(stats.latencyP50Ms) && reader.Get(stats.latencyP90Ms) && reader.Get(stats.latencyP99Ms) && reader.Get(stats.renderP50Ms);
+		}
+	}
+
+	// A long-running render process that keeps scenes, renderers (with their denoiser) and worker threads alive
+	// between jobs, so short previews pay only for rendering. Jobs arrive over loopback TCP in the messages of
+	// Network.h, wait in one queue and are rendered one at a time with all threads; every client connection
+	// can have one job in flight.
+	class RenderServer
+	{
+	public:
+		RenderServer(int port, SceneFactory sceneFactory, int threadsCount = 0, size_t latencyWindow = 10000)
+			: listener(net::Socket::Listen(port, net::ListenAddress::Loopback)), sceneFactory(std::move(sceneFactory)), threadsCount(threadsCount), latencyWindow(latencyWindow)
+		{
+		}
+
+		RenderServer(const RenderServer&) = delete;
+		RenderServer& operator=(const RenderServer&) = delete;
+
+		~RenderServer()
+		{
+			Stop();
+		}
+
+		bool IsListening() const
+		{
+			return listener.IsValid();
+		}
+
+		int Port() const
+		{
+			return listener.LocalPort();
+		}
+
+		// Serves clients until Stop is called or a client asks for a shutdown.
+		void Run()
+		{
+			std::thread renderThread([this]() { RenderLoop(); });
+			std::vector<std::pair<std::shared_ptr<net::Socket>, std::thread>> connections;
+			while (!stopping.load(std::memory_order_relaxed))
+			{
+				if (listener.WaitReadable(0.1))
+				{
+					auto client = std::make_shared<net::Socket>(listener.Accept());
+					if (client->IsValid())
+					{
+						connections.emplace_back(client, std::thread([this, client]() { Serve(*client); }));
+					}
+				}
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (auto& job : queue)
+				{
+					job->response.error = "Server stopped";
+					job->done = true;
+				}
+				queue.clear();
+			}
+			changed.notify_all();
+			for (auto& [client, thread] : connections)
+			{
+				client->Shutdown();
+				thread.join();
+			}
+			renderThread.join();
+		}
+
+		void Stop()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			changed.notify_all();
+		}
+
+		ServerStats Stats() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			ServerStats stats;
+			stats.jobsDone = jobsDone;
+			stats.queueDepth = static_cast<int32_t>(queue.size()) + (rendering ? 1 : 0);
+			stats.maxQueueDepth = maxQueueDepth;
+			stats.scenesLoaded = static_cast<int32_t>(scenes.size());
+			const std::vector<double> latencies(latenciesMs.begin(), latenciesMs.end());
+			stats.latencyP50Ms = stats::Percentile(latencies, 0.5);
+			stats.latencyP90Ms = stats::Percentile(latencies, 0.9);
+			stats.latencyP99Ms = stats::Percentile(latencies, 0.99);
+			stats.renderP50Ms = stats::Percentile(std::vector<double>(renderTimesMs.begin(), renderTimesMs.end()), 0.5);
+			return stats;
+		}
+
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		struct Job
+		{
+			RenderRequest request;
+			RenderResponse response;
+			Clock::time_point submitTime;
+			bool done = false;
+		};
+
+		void Serve(net::Socket& client)
+		{
+			uint32_t type = 0;
+			std::vector<char> payload;
+			while (net::ReceiveMessage(client, type, payload, detail::maxRequestBytes))
+			{
+				if (type == detail::renderRequestMessage)
+				{
+					auto job = std::make_shared<Job>();
+					if (!detail::ReadRequest(payload, job->request))
+					{
+						job->response.error = "Malformed request";
+					}
+					else if (std::unique_lock<std::mutex> lock(mutex); stopping)
+					{
+						job->response.error = "Server stopped";
+					}
+					else
+					{
+						job->submitTime = Clock::now();
+						job->response.queueDepth = static_cast<int32_t>(queue.size()) + (rendering ? 1 : 0);
+						maxQueueDepth = std::max(maxQueueDepth, job->response.queueDepth + 1);
+						queue.push_back(job);
+						changed.notify_all();
+						changed.wait(lock, [&]() { return job->done; });
+					}
+					if (!net::SendMessage(client, detail::renderResponseMessage, detail::ResponsePayload(job->response)))
+					{
+						return;
+					}
+				}
+				else if (type == detail::statsRequestMessage)
+				{
+					if (!net::SendMessage(client, detail::statsResponseMessage, detail::StatsPayload(Stats())))
+					{
+						return;
+					}
+				}
+				else if (type == detail::shutdownRequestMessage)
+				{
+					Stop();
+					return;
+				}
+			}
+		}
+
+		void RenderLoop()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (true)
+			{
+				changed.wait(lock, [&]() { return stopping || !queue.empty(); });
+				if (stopping)
+				{
+					return;
+				}
+				auto job = queue.front();
+				queue.pop_front();
+				rendering = true;
+				lock.unlock();
+
+				const auto startTime = Clock::now();
+				// A failing job must not take the server and the jobs queued behind it down.
+				try
+				{
+					Render(job->request, job->response);
+				}
+				catch (const std::exception& exception)
+				{
+					job->response.ok = false;
+					job->response.error = exception.what();
+					job->response.image.clear();
+				}
+				const auto endTime = Clock::now();
+				job->response.queueMs = std::chrono::duration<double, std::milli>(startTime - job->submitTime).count();
+				job->response.renderMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+				job->response.latencyMs = std::chrono::duration<double, std::milli>(endTime - job->submitTime).count();
+
+				lock.lock();
+				rendering = false;
+				job->done = true;
+				jobsDone++;
+				latenciesMs.push_back(job->response.latencyMs);
+				renderTimesMs.push_back(job->response.renderMs);
+				if (latenciesMs.size() > latencyWindow)
+				{
+					latenciesMs.pop_front();
+					renderTimesMs.pop_front();
+				}
+				changed.notify_all();
+			}
+		}
+
+		// Runs on the render thread only, so the caches need no lock besides the one guarding Stats. Scene factory
+		// and allocation failures throw and end up in the response of the job.
+		void Render(const RenderRequest& request, RenderResponse& response)
+		{
+			if (request.imageWidth <= 0 || request.imageHeight <= 0 || request.imageWidth > 16384 || request.imageHeight > 16384
+				|| request.samplesPerPixel <= 0 || request.maxDepth <= 0)
+			{
+				response.error = "Invalid image size, sample count or depth";
+				return;
+			}
+
+			auto scene = scenes.find(request.scene);
+			if (scene == scenes.end())
+			{
+				auto loaded = std::make_unique<Scene>(sceneFactory(request.scene));
+				std::lock_guard<std::mutex> lock(mutex);
+				scene = scenes.emplace(request.scene, std::move(loaded)).first;
+			}
+
+			auto& renderer = renderers[{ request.imageWidth, request.imageHeight }];
+			if (renderer == nullptr)
+			{
+				renderer = std::make_unique<Renderer>(request.imageWidth, request.imageHeight);
+				renderer->SetThreadsCount(threadsCount);
+				renderer->ClearProgressSubscribers();
+			}
+
+			const size_t bufferSize = static_cast<size_t>(request.imageWidth) * request.imageHeight * 3;
+			std::vector<float> image(bufferSize), albedo(bufferSize), normal(bufferSize), output(request.denoise ? bufferSize : 0);
+			renderer->RenderImageWithFeatures(request.camera.Create(), *scene->second, request.samplesPerPixel, request.maxDepth, image,
+				request.denoise ? &albedo : nullptr, request.denoise ? &normal : nullptr);
+			if (request.denoise)
+			{
+				renderer->DenoiseImage(image, albedo, normal, output);
+				image.swap(output);
+			}
+			if (!request.outputPath.empty() && !SaveImage(request.outputPath, image, request.imageWidth, request.imageHeight))
+			{
+				response.error = "Cannot save " + request.outputPath;
+				return;
+			}
+
+			response.ok = true;
+			response.imageWidth = request.imageWidth;
+			response.imageHeight = request.imageHeight;
+			if (request.returnImage)
+			{
+				response.image = std::move(image);
+			}
+		}
+
+		net::Socket listener;
+		const SceneFactory sceneFactory;
+		const int threadsCount;
+		const size_t latencyWindow;
+		std::atomic<bool> stopping = false;
+
+		mutable std::mutex mutex;
+		std::condition_variable changed;
+		std::deque<std::shared_ptr<Job>> queue;
+		bool rendering = false;
+		int64_t jobsDone = 0;
+		int32_t maxQueueDepth = 0;
+		std::deque<double> latenciesMs;
+		std::deque<double> renderTimesMs;
+		std::map<std::string, std::unique_ptr<Scene>> scenes;
+		std::map<std::pair<int, int>, std::unique_ptr<Renderer>> renderers;
+	};
+
+	// One connection to a render server. Calls block until the server answers.
+	class RenderClient
+	{
+	public:
+		RenderClient(const std::string& host, int port) : server(net::Socket::Connect(host, port))
+		{
+		}
+
+		bool IsConnected() const
+		{
+			return server.IsValid();
+		}
+
+		// False when the connection failed; a job the server rejected returns true with response.ok false.
+		bool Render(const RenderRequest& request, RenderResponse& response)
+		{
+			uint32_t type = 0;
+			std::vector<char> payload;
+			const uint64_t maxResponseBytes = detail::maxRequestBytes + static_cast<uint64_t>(std::max(request.imageWidth, 0)) * std::max(request.imageHeight, 0) * 3 * sizeof(float);
+			return net::SendMessage(server, detail::renderRequestMessage, detail::RequestPayload(request)) && net::ReceiveMessage(server, type, payload, maxResponseBytes)
+				&& type == detail::renderResponseMessage && detail::ReadResponse(payload, response);
+		}
+
+		bool Stats(ServerStats& stats)
+		{
+			uint32_t type = 0;
+			std::vector<char> payload;
+			return net::SendMessage(server, detail::statsRequestMessage, {}) && net::ReceiveMessage(server, type, payload, detail::maxRequestBytes)
+				&& type == detail::statsResponseMessage && detail::ReadStats(payload, stats);
+		}
+
+		bool Shutdown()
+		{
+			return net::SendMessage(server, detail::shutdownRequestMessage, {});
+		}
+
+	private:
+		net::Socket server;
+	};
+}
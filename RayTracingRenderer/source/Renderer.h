@@ -1,86 +1,740 @@
 #pragma once
 
+#include "AccumulationBuffer.h"
 #include "Color.h"
 #include "Ray.h"
 #include "Camera.h"
+#include "Checkpoint.h"
 #include "HittableObject.h"
 #include "Scene.h"
 #include "Material.h"
+#include "Numa.h"
+#include "PartialSamples.h"
+#include "Random.h"
+#include "Sampler.h"
+#include "Parallel.h"
+#include "RenderControl.h"
+#include "Statistics.h"
+#include "TileScheduler.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <iostream>
 #include <vector>
 #include <chrono>
-#include <ppl.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
 #include <OpenImageDenoise/oidn.hpp>
 
 namespace rtr
 {
+	struct TimedRenderReport
+	{
+		int passesCount = 0;          // Passes started, the last one may cover only part of the image.
+		uint32_t minSamplesPerPixel = 0;
+		uint32_t maxSamplesPerPixel = 0;
+		double meanSamplesPerPixel = 0.0;
+		double renderTimeMs = 0.0;
+		double overshootMs = 0.0;     // Time past the deadline, zero when finished in time.
+		double maxTileTimeMs = 0.0;   // Longest single tile, the bound on the overshoot.
+	};
+
+	struct AdaptiveSettings
+	{
+		int minSamplesPerPixel = 16;
+		int maxSamplesPerPixel = 1024; // Rounded up to whole passes.
+		int samplesPerPass = 8;
+		double errorThreshold = 0.005; // Standard error of the displayed (gamma corrected) value.
+	};
+
+	struct AdaptiveRenderReport
+	{
+		int passesCount = 0;
+		uint64_t samplesCount = 0;
+		uint64_t uniformSamplesCount = 0; // Samples of every pixel at maxSamplesPerPixel.
+		double savedSamplesFraction = 0.0;
+		double renderTimeMs = 0.0;
+	};
+
+	// First-hit features of camera rays for the denoiser, summed over samples. Rays that miss add the
+	// background as albedo and the reversed ray direction as normal, but no depth.
+	struct PrimaryFeatures
+	{
+		Color albedo;
+		Vector3 normal;
+		double depth = 0.0; // Distance to the first hit.
+		int hitsCount = 0;
+	};
+
+	struct CheckpointSettings
+	{
+		std::string fileName;
+		double intervalSeconds = 600.0; // Checked at pass boundaries.
+		int samplesPerPass = 16;
+	};
+
+	struct CheckpointRenderReport
+	{
+		bool completed = false;
+		bool resumed = false;         // Started from an existing checkpoint.
+		uint32_t resumedSamplesPerPixel = 0;
+		int checkpointsCount = 0;
+		double copyTimeMs = 0.0;      // Time the render waited for buffer copies.
+		double writeTimeMs = 0.0;     // Time the writer thread spent writing, overlapped with rendering.
+		double renderTimeMs = 0.0;
+	};
+
 	class Renderer
 	{
 	public:
 
 		Renderer(int renderWidth, int renderHeight) : imageWidth(renderWidth), imageHeight(renderHeight) {}
 
+		// A cancelled render leaves the tiles it did not start untouched in imageOutBuffer.
+		// Only the crop window is rendered when one is set, see SetCropWindow.
 		void RenderImage(const Camera& camera, const Scene& scene, int samplesPerPixel, int maxDepth, std::vector<float>& imageOutBuffer)
+		{
+			RenderImageWithFeatures(camera, scene, samplesPerPixel, maxDepth, imageOutBuffer, nullptr, nullptr);
+		}
+
+		// RenderImage that also writes the albedo and normal of the first hit of every camera ray, and the mean
+		// first hit distance when depthOutBuffer is given (zero where no sample hit). The features come from
+		// the primary hits the image is traced from anyway, so they cost no extra rays, and the image is the
+		// same as RenderImage's. Albedo is gamma corrected like RenderAlbedo's output; any buffer may be null.
+		// Unlike separate RenderAlbedo and RenderNormal passes with a pinhole camera, the features share the
+		// camera's aperture, so they are blurred by defocus exactly like the image; the denoiser expects that.
+		void RenderImageWithFeatures(const Camera& camera, const Scene& scene, int samplesPerPixel, int maxDepth, std::vector<float>& imageOutBuffer,
+			std::vector<float>* albedoOutBuffer, std::vector<float>* normalOutBuffer, std::vector<float>* depthOutBuffer = nullptr)
 		{	
-			concurrency::critical_section criticalSection;
-			int renderedLinesCounter = 0;
+			const auto tiles = Tiles();
 			const auto startTime = std::chrono::high_resolution_clock::now();
+			const bool withFeatures = albedoOutBuffer != nullptr || normalOutBuffer != nullptr || depthOutBuffer != nullptr;
+			progress.Start(tiles.size());
+			stats::ProgressReporter reporter(progress, progressSubscribers, progressIntervalMs);
+
+			TileScheduler(threadsCount).Run(tiles, [&](const Tile& tile)
+				{
+					const uint64_t raysBefore = stats::raysTraced;
+					auto sampler = CreateSampler(0, samplesPerPixel);
+					for (int k = tile.y0; k < tile.y1; k++)
+					{
+						for (int i = tile.x0; i < tile.x1; i++)
+						{
+							PrimaryFeatures features;
+							Color pixelColor = SamplePixelRange(camera, scene, i, k, 0, samplesPerPixel, maxDepth, *sampler, nullptr, withFeatures ? &features : nullptr);
+							pixelColor.Normalize(samplesPerPixel);
+							pixelColor.CorrectGamma();
+							const size_t index = OutputIndex(i, k) * 3;
+							imageOutBuffer[index] = static_cast<float>(pixelColor.R());
+							imageOutBuffer[index + 1] = static_cast<float>(pixelColor.G());
+							imageOutBuffer[index + 2] = static_cast<float>(pixelColor.B());
+
+							if (albedoOutBuffer != nullptr)
+							{
+								features.albedo.Normalize(samplesPerPixel);
+								features.albedo.CorrectGamma();
+								(*albedoOutBuffer)[index] = static_cast<float>(features.albedo.R());
+								(*albedoOutBuffer)[index + 1] = static_cast<float>(features.albedo.G());
+								(*albedoOutBuffer)[index + 2] = static_cast<float>(features.albedo.B());
+							}
+							if (normalOutBuffer != nullptr)
+							{
+								const Vector3 normal = features.normal / samplesPerPixel;
+								(*normalOutBuffer)[index] = static_cast<float>(normal.X());
+								(*normalOutBuffer)[index + 1] = static_cast<float>(normal.Y());
+								(*normalOutBuffer)[index + 2] = static_cast<float>(normal.Z());
+							}
+							if (depthOutBuffer != nullptr)
+							{
+								(*depthOutBuffer)[index / 3] = features.hitsCount > 0 ? static_cast<float>(features.depth / features.hitsCount) : 0.0f;
+							}
+						}
+					}
+
+					const uint64_t pixelsCount = static_cast<uint64_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+					progress.AddTile(pixelsCount * samplesPerPixel, stats::raysTraced - raysBefore);
+				},
+				[&]() { return StopRequested(); });
+
+			const auto endTime = std::chrono::high_resolution_clock::now();
+			std::cout << "Image render time:: " << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(endTime - startTime).count() << " ms" << '\n';
+		}
+
+		// Adds samplesPerPass samples to every pixel, continuing each pixel's sample sequence where the
+		// buffer left it. expectedSamplesPerPixel is the final count, for samplers that need to know it.
+		void RenderPass(const Camera& camera, const Scene& scene, int samplesPerPass, int maxDepth, AccumulationBuffer& accumulation, int expectedSamplesPerPixel = 0)
+		{
+			const auto tiles = Tiles();
+			progress.Start(tiles.size());
+			stats::ProgressReporter reporter(progress, progressSubscribers, progressIntervalMs);
+			RunPass(camera, scene, tiles, samplesPerPass, maxDepth, std::max(expectedSamplesPerPixel, samplesPerPass), accumulation);
+		}
+
+		// Renders passes until the time budget is spent or maxSamplesPerPixel is reached. A tile is only started
+		// when its cost in the previous pass still fits before the deadline, so the deadline is overrun by at
+		// most one tile whose cost was not known yet or grew. Per-pixel sample counts are left in the buffer.
+		TimedRenderReport RenderForTime(const Camera& camera, const Scene& scene, double timeBudgetMs, int maxDepth, AccumulationBuffer& accumulation,
+			int samplesPerPass = 1, int maxSamplesPerPixel = 4096)
+		{
+			using Clock = std::chrono::steady_clock;
+			const auto startTime = Clock::now();
+			const auto deadline = startTime + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(timeBudgetMs));
+			const auto tiles = Tiles();
+			std::vector<Clock::duration> tileCosts(tiles.size(), Clock::duration::zero());
+			std::vector<int> tilePasses(tiles.size(), 0);
+			TimedRenderReport report;
+			progress.Start(0);
+			stats::ProgressReporter reporter(progress, progressSubscribers, progressIntervalMs);
+
+			// An empty window has nothing to render and reports zeros.
+			bool finished = tiles.empty();
+			while (!finished && (report.passesCount + 1) * samplesPerPass <= maxSamplesPerPixel && Clock::now() < deadline)
+			{
+				const int pass = report.passesCount++;
+				TileScheduler(threadsCount).Run(tiles, [&](const Tile& tile)
+					{
+						const size_t index = &tile - tiles.data();
+						const auto tileStart = Clock::now();
+						if (tileStart + tileCosts[index] > deadline)
+						{
+							return;
+						}
+						RenderTilePass(camera, scene, tile, samplesPerPass, maxDepth, maxSamplesPerPixel, accumulation);
+						tileCosts[index] = Clock::now() - tileStart;
+						tilePasses[index] = pass + 1;
+					},
+					[&]() { return Clock::now() >= deadline || StopRequested(); });
+
+				// A pass that left out tiles is the last one.
+				finished = StopRequested() || std::any_of(tilePasses.begin(), tilePasses.end(), [&](int passes) { return passes <= pass; });
+			}
+
+			const auto endTime = Clock::now();
+			report.renderTimeMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+			report.overshootMs = std::max(0.0, std::chrono::duration<double, std::milli>(endTime - deadline).count());
+			if (!tileCosts.empty())
+			{
+				report.maxTileTimeMs = std::chrono::duration<double, std::milli>(*std::max_element(tileCosts.begin(), tileCosts.end())).count();
+			}
+
+			const Tile window = Window();
+			const size_t pixelsCount = static_cast<size_t>(window.x1 - window.x0) * (window.y1 - window.y0);
+			if (pixelsCount == 0)
+			{
+				return report;
+			}
+			uint64_t samplesSum = 0;
+			report.minSamplesPerPixel = UINT32_MAX;
+			for (int k = window.y0; k < window.y1; k++)
+			{
+				for (int i = window.x0; i < window.x1; i++)
+				{
+					const uint32_t samples = accumulation.SampleCount(i, k);
+					report.minSamplesPerPixel = std::min(report.minSamplesPerPixel, samples);
+					report.maxSamplesPerPixel = std::max(report.maxSamplesPerPixel, samples);
+					samplesSum += samples;
+				}
+			}
+			report.meanSamplesPerPixel = static_cast<double>(samplesSum) / pixelsCount;
+			return report;
+		}
+
+		// Renders passesCount passes of samplesPerPass samples. After every pass onPassRendered is called with
+		// the number of finished passes and may take a snapshot of the buffer. The final snapshot matches
+		// RenderImage with passesCount * samplesPerPass samples up to float rounding of the sums.
+		void RenderProgressive(const Camera& camera, const Scene& scene, int passesCount, int samplesPerPass, int maxDepth, AccumulationBuffer& accumulation,
+			const std::function<void(int)>& onPassRendered)
+		{
+			const auto tiles = Tiles();
+			progress.Start(tiles.size() * passesCount);
+			stats::ProgressReporter reporter(progress, progressSubscribers, progressIntervalMs);
+			for (int pass = 1; pass <= passesCount && !StopRequested(); pass++)
+			{
+				RunPass(camera, scene, tiles, samplesPerPass, maxDepth, passesCount * samplesPerPass, accumulation);
+				if (onPassRendered && !StopRequested())
+				{
+					onPassRendered(pass);
+				}
+			}
+		}
+
+		// Samples every pixel minSamplesPerPixel times, then keeps adding passes only to pixels whose estimated
+		// display error, or that of a neighbour, is above the threshold. Tiles without such pixels are skipped.
+		// Neighbours are included because the variance of a few samples can underestimate rare bright paths.
+		AdaptiveRenderReport RenderAdaptive(const Camera& camera, const Scene& scene, int maxDepth, AccumulationBuffer& accumulation, const AdaptiveSettings& settings)
+		{
+			const auto startTime = std::chrono::high_resolution_clock::now();
+			const auto tiles = Tiles();
+			const Tile window = Window();
+			const size_t pixelsCount = static_cast<size_t>(imageWidth) * imageHeight;
+			AdaptiveRenderReport report;
+			if (window.x1 <= window.x0 || window.y1 <= window.y0)
+			{
+				return report;
+			}
+			std::vector<uint8_t> aboveThreshold(pixelsCount), active(pixelsCount);
+			progress.Start(0);
+			stats::ProgressReporter reporter(progress, progressSubscribers, progressIntervalMs);
+
+			TileScheduler(threadsCount).Run(tiles, [&](const Tile& tile)
+				{
+					RenderTilePass(camera, scene, tile, settings.minSamplesPerPixel, maxDepth, settings.maxSamplesPerPixel, accumulation);
+				},
+				[&]() { return StopRequested(); });
+			report.passesCount = 1;
+
+			while (!StopRequested())
+			{
+				parallel::For(window.y0, window.y1, threadsCount, [&](int k)
+					{
+						for (int i = window.x0; i < window.x1; i++)
+						{
+							size_t index = static_cast<size_t>(k) * imageWidth + i;
+							aboveThreshold[index] = accumulation.SampleCount(i, k) < static_cast<uint32_t>(settings.maxSamplesPerPixel)
+								&& accumulation.DisplayError(i, k) > settings.errorThreshold;
+						}
+					});
+
+				parallel::For(window.y0, window.y1, threadsCount, [&](int k)
+					{
+						for (int i = window.x0; i < window.x1; i++)
+						{
+							bool pixelActive = false;
+							for (int dk = std::max(window.y0, k - 1); dk <= std::min(window.y1 - 1, k + 1) && !pixelActive; dk++)
+							{
+								for (int di = std::max(window.x0, i - 1); di <= std::min(window.x1 - 1, i + 1) && !pixelActive; di++)
+								{
+									pixelActive = aboveThreshold[static_cast<size_t>(dk) * imageWidth + di];
+								}
+							}
+							active[static_cast<size_t>(k) * imageWidth + i] = pixelActive && accumulation.SampleCount(i, k) < static_cast<uint32_t>(settings.maxSamplesPerPixel);
+						}
+					});
 
-			concurrency::parallel_for(int(0), imageHeight, [&](int k)
+				std::vector<Tile> activeTiles;
+				for (const auto& tile : tiles)
+				{
+					bool tileActive = false;
+					for (int k = tile.y0; k < tile.y1 && !tileActive; k++)
+					{
+						auto row = active.begin() + static_cast<size_t>(k) * imageWidth;
+						tileActive = std::find(row + tile.x0, row + tile.x1, uint8_t(1)) != row + tile.x1;
+					}
+					if (tileActive)
+					{
+						activeTiles.push_back(tile);
+					}
+				}
+				if (activeTiles.empty())
 				{
-					int j = imageHeight - 1 - k;
-					for (int i = 0; i < imageWidth; i++)
+					break;
+				}
+
+				TileScheduler(threadsCount).Run(activeTiles, [&](const Tile& tile)
 					{
-						Color pixelColor(0.0, 0.0, 0.0);
-						for (int sample = 0; sample < samplesPerPixel; sample++)
+						RenderTilePass(camera, scene, tile, settings.samplesPerPass, maxDepth, settings.maxSamplesPerPixel, accumulation, &active);
+					},
+					[&]() { return StopRequested(); });
+				report.passesCount++;
+			}
+
+			for (int k = window.y0; k < window.y1; k++)
+			{
+				for (int i = window.x0; i < window.x1; i++)
+				{
+					report.samplesCount += accumulation.SampleCount(i, k);
+				}
+			}
+			report.uniformSamplesCount = static_cast<uint64_t>(window.x1 - window.x0) * (window.y1 - window.y0) * settings.maxSamplesPerPixel;
+			report.savedSamplesFraction = 1.0 - static_cast<double>(report.samplesCount) / report.uniformSamplesCount;
+			report.renderTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+			return report;
+		}
+
+		// Brings every pixel up to samplesPerPixel samples, skipping the samples the buffer already has, so a
+		// render stopped through the render control continues where it left off. Returns false when stopped.
+		bool RenderToSampleCount(const Camera& camera, const Scene& scene, int samplesPerPixel, int maxDepth, AccumulationBuffer& accumulation)
+		{
+			const auto tiles = Tiles();
+			progress.Start(tiles.size());
+			stats::ProgressReporter reporter(progress, progressSubscribers, progressIntervalMs);
+			return RunToSampleCount(camera, scene, tiles, samplesPerPixel, samplesPerPixel, maxDepth, accumulation, control.get());
+		}
+
+		// Adds samples [sampleOffset, sampleOffset + samplesPerPixel) of every pixel of the window to the buffer as
+		// linear, unclamped double sums and records the run, for runs on other machines or at other times to be
+		// merged with (see MergePartialSamples). Runs with the same seed and adjacent offsets merge to the result
+		// of one run over the whole range, up to floating-point summation order. Samplers that stratify over a
+		// pixel's samples need the end of that range as expectedSamplesPerPixel in every run but the last;
+		// without it each run is stratified alone.
+		// Returns false when stopped; the run is then not recorded and the samples added so far should be discarded.
+		bool RenderPartialSamples(const Camera& camera, const Scene& scene, int samplesPerPixel, int maxDepth, PartialSampleBuffer& samples,
+			int expectedSamplesPerPixel = 0)
+		{
+			const int samplerSamplesPerPixel = std::max(samplesPerPixel, expectedSamplesPerPixel - sampleOffset);
+			const auto tiles = Tiles();
+			std::atomic<size_t> tilesDone = 0;
+			progress.Start(tiles.size());
+			stats::ProgressReporter reporter(progress, progressSubscribers, progressIntervalMs);
+			TileScheduler(threadsCount).Run(tiles, [&](const Tile& tile)
+				{
+					const uint64_t raysBefore = stats::raysTraced;
+					auto sampler = CreateSampler(0, samplerSamplesPerPixel);
+					for (int k = tile.y0; k < tile.y1; k++)
+					{
+						for (int i = tile.x0; i < tile.x1; i++)
 						{
-							auto u = (i + util::RandomDouble()) / (imageWidth - 1);
-							auto v = (j + util::RandomDouble()) / (imageHeight - 1);
-							rtr::Ray ray = camera.GetRay(u, v);
-							pixelColor += RayColor(ray, scene, maxDepth);
+							double squaredLuminanceSum = 0.0;
+							Color sampleSum = SamplePixelRange(camera, scene, i, k, 0, samplesPerPixel, maxDepth, *sampler, &squaredLuminanceSum);
+							samples.Add(i, k, sampleSum, squaredLuminanceSum, samplesPerPixel);
 						}
-						pixelColor.Normalize(samplesPerPixel);
-						pixelColor.CorrectGamma();
-						imageOutBuffer[(imageHeight - 1 - j) * imageWidth * 3 + i * 3] = static_cast<float>(pixelColor.R());
-						imageOutBuffer[(imageHeight - 1 - j) * imageWidth * 3 + i * 3 + 1] = static_cast<float>(pixelColor.G());
-						imageOutBuffer[(imageHeight - 1 - j) * imageWidth * 3 + i * 3 + 2] = static_cast<float>(pixelColor.B());
 					}
+					progress.AddTile(static_cast<uint64_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0) * samplesPerPixel, stats::raysTraced - raysBefore);
+					tilesDone.fetch_add(1, std::memory_order_relaxed);
+				},
+				[&]() { return StopRequested(); });
+			if (tilesDone != tiles.size())
+			{
+				return false;
+			}
+			samples.Runs().push_back({ seed, sampleOffset, samplesPerPixel });
+			samples.Sampler() = samplerPrototype->Name();
+			return true;
+		}
 
-					criticalSection.lock();
-					renderedLinesCounter++;
-					if (renderedLinesCounter % 50 == 0)
+		// RenderToSampleCount in passes of settings.samplesPerPass samples. After a pass that ends later than
+		// the interval after the last checkpoint, a copy of the buffer is handed to a writer thread, and a final
+		// checkpoint is written at the end. A valid checkpoint in the file made with the same settings, seed,
+		// sample offset and sampler is loaded first; the render then continues to the same result it would
+		// have reached without interruption.
+		CheckpointRenderReport RenderWithCheckpoints(const Camera& camera, const Scene& scene, int samplesPerPixel, int maxDepth, AccumulationBuffer& accumulation,
+			const CheckpointSettings& settings)
+		{
+			using Clock = std::chrono::steady_clock;
+			const auto startTime = Clock::now();
+			const auto tiles = Tiles();
+			const int samplesPerPass = std::max(1, std::min(settings.samplesPerPass, samplesPerPixel));
+			const int passesCount = (samplesPerPixel + samplesPerPass - 1) / samplesPerPass;
+			CheckpointRenderReport report;
+
+			CheckpointState state{ seed, sampleOffset, samplesPerPixel, samplesPerPass, samplerPrototype->Name() };
+			CheckpointState loadedState;
+			AccumulationBuffer loaded(imageWidth, imageHeight);
+			if (LoadCheckpoint(settings.fileName, loaded, loadedState) && loadedState == state)
+			{
+				accumulation = std::move(loaded);
+				report.resumed = true;
+				report.resumedSamplesPerPixel = UINT32_MAX;
+				const Tile window = Window();
+				for (int k = window.y0; k < window.y1; k++)
+				{
+					for (int i = window.x0; i < window.x1; i++)
 					{
-						std::cout << "Rendered lines: " << renderedLinesCounter << "/" << imageHeight << '\n';
+						report.resumedSamplesPerPixel = std::min(report.resumedSamplesPerPixel, accumulation.SampleCount(i, k));
 					}
-					criticalSection.unlock();
+				}
+			}
+
+			progress.Start(tiles.size() * passesCount);
+			stats::ProgressReporter reporter(progress, progressSubscribers, progressIntervalMs);
+			CheckpointWriter writer(settings.fileName);
+			auto submit = [&]()
+			{
+				const auto copyStart = Clock::now();
+				writer.Submit(accumulation, state);
+				report.copyTimeMs += std::chrono::duration<double, std::milli>(Clock::now() - copyStart).count();
+				report.checkpointsCount++;
+			};
+
+			auto lastCheckpoint = Clock::now();
+			report.completed = true;
+			for (int pass = 1; pass <= passesCount && report.completed; pass++)
+			{
+				report.completed = RunToSampleCount(camera, scene, tiles, std::min(pass * samplesPerPass, samplesPerPixel), samplesPerPixel, maxDepth, accumulation, control.get());
+				if (report.completed && pass < passesCount && Clock::now() - lastCheckpoint >= std::chrono::duration<double>(settings.intervalSeconds))
+				{
+					submit();
+					lastCheckpoint = Clock::now();
+				}
+			}
+
+			// A stopped pass leaves some tiles ahead of the others, which the next run skips.
+			submit();
+			writer.Finish();
+			report.writeTimeMs = writer.WriteTimeMs();
+			report.renderTimeMs = std::chrono::duration<double, std::milli>(Clock::now() - startTime).count();
+			return report;
+		}
+
+		// Starts RenderToSampleCount on its own thread, continuing from the given buffer. The handle cancels,
+		// pauses and resumes it, instead of the control set with SetRenderControl, and returns the buffer with the
+		// samples every region received. The scene and this renderer must outlive the render and not be used by
+		// anything else while it runs.
+		RenderHandle StartRender(const Camera& camera, const Scene& scene, int samplesPerPixel, int maxDepth, AccumulationBuffer accumulation)
+		{
+			auto renderControl = std::make_shared<RenderControl>();
+			return RenderHandle(renderControl, [this, camera, &scene, samplesPerPixel, maxDepth, accumulation = std::move(accumulation), renderControl]() mutable
+				{
+					PartialRender result{ std::move(accumulation), {}, {}, false };
+					const auto tiles = Tiles();
+					progress.Start(tiles.size());
+					{
+						stats::ProgressReporter reporter(progress, progressSubscribers, progressIntervalMs);
+						result.completed = RunToSampleCount(camera, scene, tiles, samplesPerPixel, samplesPerPixel, maxDepth, result.accumulation, renderControl.get());
+					}
+					result.regions = tiles;
+					for (const auto& region : result.regions)
+					{
+						// Empty regions have no samples rather than the initial minimum.
+						uint32_t samples = region.x0 < region.x1 && region.y0 < region.y1 ? UINT32_MAX : 0;
+						for (int k = region.y0; k < region.y1; k++)
+						{
+							for (int i = region.x0; i < region.x1; i++)
+							{
+								samples = std::min(samples, result.accumulation.SampleCount(i, k));
+							}
+						}
+						result.regionSamplesPerPixel.push_back(samples);
+					}
+					return result;
 				});
+		}
 
-			const auto endTime = std::chrono::high_resolution_clock::now();
-			std::cout << "Image render time:: " << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(endTime - startTime).count() << " ms" << '\n';
+		RenderHandle StartRender(const Camera& camera, const Scene& scene, int samplesPerPixel, int maxDepth)
+		{
+			return StartRender(camera, scene, samplesPerPixel, maxDepth, AccumulationBuffer(imageWidth, imageHeight));
+		}
+
+		// Makes every following render check the control at tile boundaries; nullptr disables the checks.
+		void SetRenderControl(std::shared_ptr<RenderControl> renderControl)
+		{
+			control = std::move(renderControl);
+		}
+
+		// Counters of the running or last render, safe to poll from any thread while rendering.
+		const stats::RenderProgress& Progress() const
+		{
+			return progress;
+		}
+
+		// Subscribers are called from a reporting thread every progress interval during a render and once at
+		// its end. Standard output is subscribed by default.
+		void AddProgressSubscriber(stats::ProgressCallback subscriber)
+		{
+			progressSubscribers.push_back(std::move(subscriber));
+		}
+
+		void ClearProgressSubscribers()
+		{
+			progressSubscribers.clear();
+		}
+
+		void SetProgressInterval(double intervalMs)
+		{
+			progressIntervalMs = intervalMs;
+		}
+
+		// Worker threads of the tile scheduler, all hardware threads by default.
+		void SetThreadsCount(int count)
+		{
+			threadsCount = count > 0 ? count : parallel::DefaultThreadsCount();
+		}
+
+		int ThreadsCount() const
+		{
+			return threadsCount;
+		}
+
+		// Restricts every following render to window, a rectangle of the full frame with rows from the top.
+		// Pixels keep their full frame camera mapping and sample sequences, so they match the same pixels of a
+		// full render exactly. Image buffers hold either the full frame, of which only the window is written,
+		// or with compactOutput just the window (OutputWidth() x OutputHeight()). Accumulation buffers always
+		// hold the full frame.
+		void SetCropWindow(const Tile& window, bool compact = false)
+		{
+			cropWindow.x0 = std::clamp(window.x0, 0, imageWidth);
+			cropWindow.y0 = std::clamp(window.y0, 0, imageHeight);
+			cropWindow.x1 = std::clamp(window.x1, cropWindow.x0, imageWidth);
+			cropWindow.y1 = std::clamp(window.y1, cropWindow.y0, imageHeight);
+			compactOutput = compact;
+			cropped = true;
+		}
+
+		void ClearCropWindow()
+		{
+			cropped = false;
+			compactOutput = false;
+		}
+
+		// Pixels the renders cover: the crop window, or the full frame when none is set.
+		Tile Window() const
+		{
+			return cropped ? cropWindow : Tile{ 0, 0, imageWidth, imageHeight };
+		}
+
+		int OutputWidth() const
+		{
+			return compactOutput ? cropWindow.x1 - cropWindow.x0 : imageWidth;
+		}
+
+		int OutputHeight() const
+		{
+			return compactOutput ? cropWindow.y1 - cropWindow.y0 : imageHeight;
+		}
+
+		void SetTileOrder(TileOrder order)
+		{
+			tileOrder = order;
+		}
+
+		// Tiles of the image in the order every render hands them out to the scheduler.
+		std::vector<Tile> Tiles() const
+		{
+			auto tiles = SplitIntoTiles(Window(), tileSize, tileOrder);
+			return tileOrder == TileOrder::Spiral ? TileScheduler(threadsCount).Interleave(tiles) : tiles;
+		}
+
+		// Edge length of the square tiles the image is split into.
+		void SetTileSize(int size)
+		{
+			tileSize = std::max(1, size);
+		}
+
+		// Same placement for the persistent buffer of progressive rendering. Accumulated samples are discarded.
+		void FirstTouch(AccumulationBuffer& accumulation) const
+		{
+			accumulation.ReleasePages();
+			TileScheduler(threadsCount).RunOwned(Tiles(), [&](const Tile& tile)
+				{
+					for (int k = tile.y0; k < tile.y1; k++)
+					{
+						accumulation.ClearRow(k, tile.x0, tile.x1);
+					}
+				});
+		}
+
+		// Clears an image buffer and lets every tile's rows be first written by the worker that starts out
+		// owning the tile, so with parallel::SetThreadAffinity(true) pages end up on that worker's NUMA node.
+		// Call it after allocation and after changing the thread count or tile size.
+		void FirstTouch(std::vector<float>& buffer) const
+		{
+			numa::ReleasePages(buffer.data(), buffer.size() * sizeof(float));
+			TileScheduler(threadsCount).RunOwned(Tiles(), [&](const Tile& tile)
+				{
+					for (int k = tile.y0; k < tile.y1; k++)
+					{
+						auto row = buffer.begin() + OutputIndex(tile.x0, k) * 3;
+						std::fill(row, row + (tile.x1 - tile.x0) * 3, 0.0f);
+					}
+				});
+		}
+
+		void SetLightSampling(LightSampling sampling)
+		{
+			lightSampling = sampling;
+		}
+
+		void SetEnvironmentSampling(EnvironmentSampling sampling)
+		{
+			environmentSampling = sampling;
+		}
+
+		void SetSeed(uint64_t renderSeed)
+		{
+			seed = renderSeed;
+		}
+
+		// Samples [sampleOffset, sampleOffset + samplesPerPixel) are rendered, so ranges can be split between runs.
+		void SetSampleOffset(int offset)
+		{
+			sampleOffset = offset;
+		}
+
+		// Prototype cloned by every task; the default draws independent uniform values.
+		void SetSampler(std::shared_ptr<Sampler> prototype)
+		{
+			samplerPrototype = prototype;
+		}
+
+		// Sampler of one render pass. Values are derived only from (seed, pass, pixel, sample index),
+		// so the output does not depend on thread count or the order in which work is scheduled.
+		// Sample indices start at the sample offset, so the sampler is sized for the offset as well.
+		std::unique_ptr<Sampler> CreateSampler(int pass, int samplesPerPixel) const
+		{
+			auto sampler = samplerPrototype->Clone();
+			sampler->SetSeed(Hash(seed, pass));
+			sampler->SetSamplesPerPixel(sampleOffset + samplesPerPixel);
+			return sampler;
+		}
+
+		// Starts sample number sampleIndex of pixel (i, k), k counted from the top of the image.
+		void StartPixelSample(Sampler& sampler, int i, int k, int sampleIndex) const
+		{
+			sampler.StartPixelSample(i, k, sampleOffset + sampleIndex);
+		}
+
+		// One radiance sample through pixel (i, j), j counted from the bottom of the image.
+		// The first hit's features are added to features when given.
+		Color SamplePixel(const Camera& camera, const Scene& scene, int i, int j, int maxDepth, Sampler& sampler, PrimaryFeatures* features = nullptr) const
+		{
+			auto [du, dv] = sampler.Get2D();
+			auto u = (i + du) / (imageWidth - 1);
+			auto v = (j + dv) / (imageHeight - 1);
+			rtr::Ray ray = camera.GetRay(u, v, sampler);
+			return RayColor(ray, scene, maxDepth, sampler, true, 0.0, features);
+		}
+
+		// Sum of samples [firstSample, firstSample + samplesCount) of pixel (i, k), k counted from the top of the image.
+		// The sum of squared sample luminances is added to squaredLuminanceSum and the first hit features to
+		// features when given.
+		Color SamplePixelRange(const Camera& camera, const Scene& scene, int i, int k, int firstSample, int samplesCount, int maxDepth, Sampler& sampler,
+			double* squaredLuminanceSum = nullptr, PrimaryFeatures* features = nullptr) const
+		{
+			Color pixelColor(0.0, 0.0, 0.0);
+			for (int sample = firstSample; sample < firstSample + samplesCount; sample++)
+			{
+				StartPixelSample(sampler, i, k, sample);
+				Color sampleColor = SamplePixel(camera, scene, i, imageHeight - 1 - k, maxDepth, sampler, features);
+				pixelColor += sampleColor;
+				if (squaredLuminanceSum != nullptr)
+				{
+					*squaredLuminanceSum += sampleColor.Luminance() * sampleColor.Luminance();
+				}
+			}
+			return pixelColor;
 		}
 
 		void RenderAlbedo(const Camera& camera, const Scene& scene, int samplesPerPixel, std::vector<float>& imageOutBuffer)
 		{
 			const auto startTime = std::chrono::high_resolution_clock::now();
-			concurrency::parallel_for(int(0), imageHeight, [&](int k)
+			TileScheduler(threadsCount).Run(Tiles(), [&](const Tile& tile)
 				{
-					int j = imageHeight - 1 - k;
-					for (int i = 0; i < imageWidth; i++)
+					auto sampler = CreateSampler(1, samplesPerPixel);
+					for (int k = tile.y0; k < tile.y1; k++)
 					{
-						Color pixelColor(0.0, 0.0, 0.0);
-						for (int sample = 0; sample < samplesPerPixel; sample++)
+						int j = imageHeight - 1 - k;
+						for (int i = tile.x0; i < tile.x1; i++)
 						{
-							auto u = (i + util::RandomDouble()) / (imageWidth - 1);
-							auto v = (j + util::RandomDouble()) / (imageHeight - 1);
-							rtr::Ray ray = camera.GetRay(u, v);
-							pixelColor += RayAlbedo(ray, scene);
+							Color pixelColor(0.0, 0.0, 0.0);
+							for (int sample = 0; sample < samplesPerPixel; sample++)
+							{
+								StartPixelSample(*sampler, i, k, sample);
+								auto [du, dv] = sampler->Get2D();
+								auto u = (i + du) / (imageWidth - 1);
+								auto v = (j + dv) / (imageHeight - 1);
+								rtr::Ray ray = camera.GetRay(u, v, *sampler);
+								pixelColor += RayAlbedo(ray, scene, *sampler);
+							}
+							pixelColor.Normalize(samplesPerPixel);
+							pixelColor.CorrectGamma();
+							const size_t index = OutputIndex(i, k) * 3;
+							imageOutBuffer[index] = static_cast<float>(pixelColor.R());
+							imageOutBuffer[index + 1] = static_cast<float>(pixelColor.G());
+							imageOutBuffer[index + 2] = static_cast<float>(pixelColor.B());
 						}
-						pixelColor.Normalize(samplesPerPixel);
-						pixelColor.CorrectGamma();
-						imageOutBuffer[(imageHeight - 1 - j) * imageWidth * 3 + i * 3] = static_cast<float>(pixelColor.R());
-						imageOutBuffer[(imageHeight - 1 - j) * imageWidth * 3 + i * 3 + 1] = static_cast<float>(pixelColor.G());
-						imageOutBuffer[(imageHeight - 1 - j) * imageWidth * 3 + i * 3 + 2] = static_cast<float>(pixelColor.B());
 					}
 				});
 
@@ -91,23 +745,30 @@ namespace rtr
 		void RenderNormal(const Camera& camera, const Scene& scene, int samplesPerPixel, std::vector<float>& imageOutBuffer)
 		{
 			const auto startTime = std::chrono::high_resolution_clock::now();
-			concurrency::parallel_for(int(0), imageHeight, [&](int k)
+			TileScheduler(threadsCount).Run(Tiles(), [&](const Tile& tile)
 				{
-					int j = imageHeight - 1 - k;
-					for (int i = 0; i < imageWidth; i++)
+					auto sampler = CreateSampler(2, samplesPerPixel);
+					for (int k = tile.y0; k < tile.y1; k++)
 					{
-						Color pixelColor(0.0, 0.0, 0.0);
-						for (int sample = 0; sample < samplesPerPixel; sample++)
+						int j = imageHeight - 1 - k;
+						for (int i = tile.x0; i < tile.x1; i++)
 						{
-							auto u = (i + util::RandomDouble()) / (imageWidth - 1);
-							auto v = (j + util::RandomDouble()) / (imageHeight - 1);
-							rtr::Ray ray = camera.GetRay(u, v);
-							pixelColor += RayNormal(ray, scene);
+							Color pixelColor(0.0, 0.0, 0.0);
+							for (int sample = 0; sample < samplesPerPixel; sample++)
+							{
+								StartPixelSample(*sampler, i, k, sample);
+								auto [du, dv] = sampler->Get2D();
+								auto u = (i + du) / (imageWidth - 1);
+								auto v = (j + dv) / (imageHeight - 1);
+								rtr::Ray ray = camera.GetRay(u, v, *sampler);
+								pixelColor += RayNormal(ray, scene, *sampler);
+							}
+							pixelColor = pixelColor / samplesPerPixel;
+							const size_t index = OutputIndex(i, k) * 3;
+							imageOutBuffer[index] = static_cast<float>(pixelColor.R());
+							imageOutBuffer[index + 1] = static_cast<float>(pixelColor.G());
+							imageOutBuffer[index + 2] = static_cast<float>(pixelColor.B());
 						}
-						pixelColor = pixelColor / samplesPerPixel;
-						imageOutBuffer[(imageHeight - 1 - j) * imageWidth * 3 + i * 3] = static_cast<float>(pixelColor.R());
-						imageOutBuffer[(imageHeight - 1 - j) * imageWidth * 3 + i * 3 + 1] = static_cast<float>(pixelColor.G());
-						imageOutBuffer[(imageHeight - 1 - j) * imageWidth * 3 + i * 3 + 2] = static_cast<float>(pixelColor.B());
 					}
 				});
 
@@ -117,15 +778,20 @@ namespace rtr
 
 		void DenoiseImage(const std::vector<float>& imageBuffer, const std::vector<float>& albedoBuffer, const std::vector<float>& normalBuffer, std::vector<float>& imageOutBuffer)
 		{
-			oidn::DeviceRef device = oidn::newDevice();
-			device.commit();
+			// The device is created on first use and kept, so denoising a batch of frames starts it up once.
+			if (!denoiseDevice)
+			{
+				denoiseDevice = oidn::newDevice();
+				denoiseDevice.commit();
+			}
+			oidn::DeviceRef& device = denoiseDevice;
 
 			// Create a filter for denoising a color image using optional auxiliary images.
 			oidn::FilterRef filter = device.newFilter("RT"); // generic ray tracing filter
-			filter.setImage("color", (void*)&imageBuffer[0], oidn::Format::Float3, imageWidth, imageHeight);
-			filter.setImage("albedo", (void*)&albedoBuffer[0], oidn::Format::Float3, imageWidth, imageHeight); // auxiliary
-			filter.setImage("normal", (void*)&normalBuffer[0], oidn::Format::Float3, imageWidth, imageHeight); // auxiliary
-			filter.setImage("output", (void*)&imageOutBuffer[0], oidn::Format::Float3, imageWidth, imageHeight); // denoised
+			filter.setImage("color", (void*)&imageBuffer[0], oidn::Format::Float3, OutputWidth(), OutputHeight());
+			filter.setImage("albedo", (void*)&albedoBuffer[0], oidn::Format::Float3, OutputWidth(), OutputHeight()); // auxiliary
+			filter.setImage("normal", (void*)&normalBuffer[0], oidn::Format::Float3, OutputWidth(), OutputHeight()); // auxiliary
+			filter.setImage("output", (void*)&imageOutBuffer[0], oidn::Format::Float3, OutputWidth(), OutputHeight()); // denoised
 			filter.set("hdr", false); // image is HDR
 			filter.commit();
 
@@ -141,7 +807,85 @@ namespace rtr
 		}
 
 	private:
-		Color RayColor(const Ray& r, const Scene& scene, int depth)
+		void RunPass(const Camera& camera, const Scene& scene, const std::vector<Tile>& tiles, int samplesPerPass, int maxDepth, int expectedSamplesPerPixel, AccumulationBuffer& accumulation)
+		{
+			TileScheduler(threadsCount).Run(tiles, [&](const Tile& tile)
+				{
+					RenderTilePass(camera, scene, tile, samplesPerPass, maxDepth, expectedSamplesPerPixel, accumulation);
+				},
+				[&]() { return StopRequested(); });
+		}
+
+		// Brings every pixel of the tiles up to targetSamplesPerPixel. Returns false when stopped through renderControl,
+		// which may be null.
+		bool RunToSampleCount(const Camera& camera, const Scene& scene, const std::vector<Tile>& tiles, int targetSamplesPerPixel, int expectedSamplesPerPixel, int maxDepth,
+			AccumulationBuffer& accumulation, RenderControl* renderControl)
+		{
+			std::atomic<size_t> tilesDone = 0;
+			TileScheduler(threadsCount).Run(tiles, [&](const Tile& tile)
+				{
+					RenderTileSamples(camera, scene, tile, maxDepth, expectedSamplesPerPixel, accumulation, [&](int i, int k)
+						{
+							return targetSamplesPerPixel - static_cast<int>(std::min<uint32_t>(accumulation.SampleCount(i, k), targetSamplesPerPixel));
+						});
+					tilesDone.fetch_add(1, std::memory_order_relaxed);
+				},
+				[&]() { return renderControl != nullptr && renderControl->ShouldStop(); });
+			return tilesDone == tiles.size();
+		}
+
+		// Index of pixel (i, k) of the full frame in image output buffers.
+		size_t OutputIndex(int i, int k) const
+		{
+			return compactOutput ? static_cast<size_t>(k - cropWindow.y0) * (cropWindow.x1 - cropWindow.x0) + (i - cropWindow.x0) : static_cast<size_t>(k) * imageWidth + i;
+		}
+
+		bool StopRequested() const
+		{
+			return control != nullptr && control->ShouldStop();
+		}
+
+		// Adds samplesCount samples to the pixels of the tile, after the ones the buffer already has.
+		// With a mask only pixels whose mask entry is set are sampled.
+		void RenderTilePass(const Camera& camera, const Scene& scene, const Tile& tile, int samplesCount, int maxDepth, int expectedSamplesPerPixel, AccumulationBuffer& accumulation,
+			const std::vector<uint8_t>* mask = nullptr)
+		{
+			RenderTileSamples(camera, scene, tile, maxDepth, expectedSamplesPerPixel, accumulation, [&](int i, int k)
+				{
+					return mask != nullptr && !(*mask)[static_cast<size_t>(k) * imageWidth + i] ? 0 : samplesCount;
+				});
+		}
+
+		// Adds samplesCountOf(i, k) samples to every pixel of the tile, after the ones the buffer already has.
+		template<typename SamplesCountOf>
+		void RenderTileSamples(const Camera& camera, const Scene& scene, const Tile& tile, int maxDepth, int expectedSamplesPerPixel, AccumulationBuffer& accumulation,
+			const SamplesCountOf& samplesCountOf)
+		{
+			const uint64_t raysBefore = stats::raysTraced;
+			uint64_t samplesDone = 0;
+			auto sampler = CreateSampler(0, expectedSamplesPerPixel);
+			for (int k = tile.y0; k < tile.y1; k++)
+			{
+				for (int i = tile.x0; i < tile.x1; i++)
+				{
+					const int samplesCount = samplesCountOf(i, k);
+					if (samplesCount <= 0)
+					{
+						continue;
+					}
+					const int firstSample = static_cast<int>(accumulation.SampleCount(i, k));
+					double squaredLuminanceSum = 0.0;
+					Color sampleSum = SamplePixelRange(camera, scene, i, k, firstSample, samplesCount, maxDepth, *sampler, &squaredLuminanceSum);
+					accumulation.Add(i, k, sampleSum, squaredLuminanceSum, samplesCount);
+					samplesDone += samplesCount;
+				}
+			}
+			progress.AddTile(samplesDone, stats::raysTraced - raysBefore);
+		}
+
+		// Only camera rays pass features; the first hit's features are added to them.
+		Color RayColor(const Ray& r, const Scene& scene, int depth, Sampler& sampler, bool countEmitted = true, double scatterPdf = 0.0,
+			PrimaryFeatures* features = nullptr) const
 		{
 			HitRecord hitRecord;
 
@@ -151,41 +895,149 @@ namespace rtr
 				return Color(0.0, 0.0, 0.0);
 			}
 
+			stats::raysTraced++;
 			if (scene.Hit(r, 0.001, consts::infinity, hitRecord))
 			{
+				const auto& material = hitRecord.hittedMaterial;
+				Color radiance = countEmitted ? material->Emitted() : Color(0.0, 0.0, 0.0);
+
+				// Lights reached by the next diffuse bounce are already accounted for by the light sample.
+				bool sampleLights = !material->IsSpecular() && scene.HasLights();
+				if (sampleLights)
+				{
+					radiance += SampleDirectLight(hitRecord, scene, sampler);
+				}
+				if (!material->IsSpecular() && scene.Environment() != nullptr)
+				{
+					radiance += SampleEnvironment(hitRecord, scene, sampler);
+				}
+
 				Ray scatteredRay;
 				Color attenuation;
-				if (hitRecord.hittedMaterial->Scatter(r, hitRecord, attenuation, scatteredRay))
+				const bool scattered = material->Scatter(r, hitRecord, attenuation, scatteredRay, sampler);
+				if (features != nullptr)
+				{
+					features->albedo += attenuation;
+					features->normal += hitRecord.normal;
+					features->depth += hitRecord.t; // Ray directions are unit length, so t is the distance.
+					features->hitsCount++;
+				}
+				if (scattered)
 				{
-					return attenuation * RayColor(scatteredRay, scene, depth - 1);
+					double nextScatterPdf = material->IsSpecular() ? 0.0 : material->Pdf(hitRecord, scatteredRay.Direction());
+					radiance += attenuation * RayColor(scatteredRay, scene, depth - 1, sampler, !sampleLights, nextScatterPdf);
 				}
+				return radiance;
+			}
+
+			if (features != nullptr)
+			{
+				features->albedo += scene.Background(r);
+				features->normal += -r.Direction();
+			}
+
+			// Environment reached by a diffuse bounce is weighted against the environment light sample.
+			if (scatterPdf > 0.0 && scene.Environment() != nullptr)
+			{
+				double environmentPdf = scene.Environment()->Pdf(r.Direction(), environmentSampling);
+				return PowerHeuristic(scatterPdf, environmentPdf) * scene.Background(r);
+			}
+
+			return scene.Background(r);
+		}
+
+		Color SampleDirectLight(const HitRecord& hitRecord, const Scene& scene, Sampler& sampler) const
+		{
+			// Dimensions are consumed up front so later bounces stay aligned between samples.
+			auto lightU = sampler.Get1D();
+			auto [u1, u2] = sampler.Get2D();
+
+			double lightPmf;
+			const Sphere* light = scene.SampleLight(hitRecord.point, hitRecord.normal, lightU, lightSampling, lightPmf);
+			if (light == nullptr)
+			{
+				return Color(0.0, 0.0, 0.0);
+			}
+
+			Vector3 direction;
+			double directionPdf;
+			if (!light->SampleDirection(hitRecord.point, u1, u2, direction, directionPdf))
+			{
+				return Color(0.0, 0.0, 0.0);
+			}
+
+			Color scattering = hitRecord.hittedMaterial->Evaluate(hitRecord, direction);
+			if (scattering.IsBlack())
+			{
+				return Color(0.0, 0.0, 0.0);
+			}
+
+			// Shadow ray: anything in front of the sampled light occludes it.
+			stats::raysTraced++;
+			Ray shadowRay(hitRecord.point, direction);
+			HitRecord lightHit;
+			HitRecord occluderHit;
+			if (!light->Hit(shadowRay, 0.001, consts::infinity, lightHit) || scene.Hit(shadowRay, 0.001, lightHit.t * (1.0 - 1e-6), occluderHit))
+			{
+				return Color(0.0, 0.0, 0.0);
+			}
+
+			return scattering * light->material->Emitted() / (lightPmf * directionPdf);
+		}
+
+		Color SampleEnvironment(const HitRecord& hitRecord, const Scene& scene, Sampler& sampler) const
+		{
+			const EnvironmentMap* environment = scene.Environment();
+			double environmentPdf;
+			auto [u1, u2] = sampler.Get2D();
+			Vector3 direction = environment->Sample(u1, u2, environmentSampling, environmentPdf);
+			if (environmentPdf <= 0.0)
+			{
+				return Color(0.0, 0.0, 0.0);
+			}
+
+			Color scattering = hitRecord.hittedMaterial->Evaluate(hitRecord, direction);
+			if (scattering.IsBlack())
+			{
 				return Color(0.0, 0.0, 0.0);
 			}
-			Vector3 unitDirection = r.Direction();
-			auto t = 0.5 * (unitDirection.Y() + 1.0);
 
-			return (1.0 - t) * Color(1.0, 1.0, 1.0) + t * Color(0.5, 0.7, 1.0);
+			stats::raysTraced++;
+			Ray shadowRay(hitRecord.point, direction);
+			HitRecord occluderHit;
+			if (scene.Hit(shadowRay, 0.001, consts::infinity, occluderHit))
+			{
+				return Color(0.0, 0.0, 0.0);
+			}
+
+			double weight = PowerHeuristic(environmentPdf, hitRecord.hittedMaterial->Pdf(hitRecord, direction));
+			return weight * scattering * environment->Radiance(direction) / environmentPdf;
 		}
 
-		Color RayAlbedo(const Ray& r, const Scene& scene)
+		static double PowerHeuristic(double pdf, double otherPdf)
+		{
+			return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+		}
+
+		Color RayAlbedo(const Ray& r, const Scene& scene, Sampler& sampler) const
 		{
 			HitRecord hitRecord;
+			stats::raysTraced++;
 			if (scene.Hit(r, 0.001, consts::infinity, hitRecord))
 			{
 				Ray scatteredRay;
 				Color attenuation;
-				hitRecord.hittedMaterial->Scatter(r, hitRecord, attenuation, scatteredRay);
+				hitRecord.hittedMaterial->Scatter(r, hitRecord, attenuation, scatteredRay, sampler);
 				return attenuation;
 			}
-			Vector3 unitDirection = r.Direction();
-			auto t = 0.5 * (unitDirection.Y() + 1.0);
 
-			return (1.0 - t) * Color(1.0, 1.0, 1.0) + t * Color(0.5, 0.7, 1.0);
+			return scene.Background(r);
 		}
 
-		Color RayNormal(const Ray& r, const Scene& scene)
+		Color RayNormal(const Ray& r, const Scene& scene, Sampler& /*sampler*/) const
 		{
 			HitRecord hitRecord;
+			stats::raysTraced++;
 			if (scene.Hit(r, 0.001, consts::infinity, hitRecord))
 			{
 				// Visualize normals on the scene.
@@ -201,5 +1053,21 @@ namespace rtr
 	private:
 		int imageWidth;
 		int imageHeight;
+		LightSampling lightSampling = LightSampling::Hierarchy;
+		EnvironmentSampling environmentSampling = EnvironmentSampling::Importance;
+		uint64_t seed = 0;
+		int sampleOffset = 0;
+		int threadsCount = parallel::DefaultThreadsCount();
+		int tileSize = 16;
+		TileOrder tileOrder = TileOrder::Scanline;
+		Tile cropWindow;
+		bool cropped = false;
+		bool compactOutput = false;
+		std::shared_ptr<Sampler> samplerPrototype = std::make_shared<IndependentSampler>();
+		stats::RenderProgress progress;
+		std::vector<stats::ProgressCallback> progressSubscribers = { stats::StdoutProgress() };
+		double progressIntervalMs = 1000.0;
+		std::shared_ptr<RenderControl> control;
+		oidn::DeviceRef denoiseDevice;
 	};
 }
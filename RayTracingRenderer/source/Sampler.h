@@ -0,0 +1,473 @@
+#pragma once
+
+#include "Constants.h"
+#include "Random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace rtr
+{
+	// Source of sample values for the renderer. A pixel sample is started with StartPixelSample and then
+	// consumes dimensions in order: pixel position, lens position and whatever each bounce asks for.
+	// Values depend only on (seed, pixel, sample index, dimension), never on the order of calls between pixels.
+	class Sampler
+	{
+	public:
+		Sampler(uint64_t seed) : seed(seed) {}
+		virtual ~Sampler() = default;
+
+		void SetSeed(uint64_t samplerSeed)
+		{
+			seed = samplerSeed;
+		}
+
+		// Some samplers distribute a known number of samples; others ignore it.
+		virtual void SetSamplesPerPixel(int /*samplesPerPixel*/) {}
+
+		virtual void StartPixelSample(int x, int y, int index)
+		{
+			pixelX = x;
+			pixelY = y;
+			pixelHash = Hash(seed, x, y);
+			sampleIndex = index;
+			dimension = 0;
+		}
+
+		virtual double Get1D() = 0;
+		virtual std::pair<double, double> Get2D() = 0;
+
+		virtual std::unique_ptr<Sampler> Clone() const = 0;
+
+		// Stable name of the sample sequence, stored in files that must only be combined with samples of the same kind.
+		virtual const char* Name() const = 0;
+
+	protected:
+		uint64_t DimensionHash() const
+		{
+			return Hash(pixelHash, dimension);
+		}
+
+		uint64_t seed;
+		int pixelX = 0;
+		int pixelY = 0;
+		uint64_t pixelHash = 0;
+		int sampleIndex = 0;
+		int dimension = 0;
+	};
+
+	namespace detail
+	{
+		// Kensler's hash-based permutation: element i of a random permutation of [0, l) selected by p.
+		inline uint32_t PermutationElement(uint32_t i, uint32_t l, uint32_t p)
+		{
+			uint32_t w = l - 1;
+			w |= w >> 1;
+			w |= w >> 2;
+			w |= w >> 4;
+			w |= w >> 8;
+			w |= w >> 16;
+			do
+			{
+				i ^= p;
+				i *= 0xe170893d;
+				i ^= p >> 16;
+				i ^= (i & w) >> 4;
+				i ^= p >> 8;
+				i *= 0x0929eb3f;
+				i ^= p >> 23;
+				i ^= (i & w) >> 1;
+				i *= 1 | p >> 27;
+				i *= 0x6935fa69;
+				i ^= (i & w) >> 11;
+				i *= 0x74dcb303;
+				i ^= (i & w) >> 2;
+				i *= 0x9e501cc3;
+				i ^= (i & w) >> 2;
+				i *= 0xc860a3df;
+				i &= w;
+				i ^= i >> 5;
+			} while (i >= l);
+			return (i + p) % l;
+		}
+
+		inline uint32_t ReverseBits(uint32_t x)
+		{
+			x = (x << 16) | (x >> 16);
+			x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+			x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+			x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+			x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+			return x;
+		}
+
+		// Hash-based Owen scrambling (Burley 2020): the Laine-Karras permutation applied to reversed bits
+		// flips every digit depending only on the digits above it.
+		inline uint32_t NestedUniformScramble(uint32_t x, uint32_t seed)
+		{
+			x = ReverseBits(x);
+			x += seed;
+			x ^= x * 0x6c50b47cu;
+			x ^= x * 0xb82f1e52u;
+			x ^= x * 0xc7afe638u;
+			x ^= x * 0x8d22f6e6u;
+			return ReverseBits(x);
+		}
+
+		inline double ToUnitInterval(uint32_t x)
+		{
+			return std::min(x * 0x1p-32, consts::oneMinusEpsilon);
+		}
+
+		inline uint32_t SobolDimension0(uint32_t index)
+		{
+			return ReverseBits(index);
+		}
+
+		inline uint32_t SobolDimension1(uint32_t index)
+		{
+			// Direction numbers of the second dimension (primitive polynomial x + 1): v[k] = v[k-1] ^ (v[k-1] >> 1).
+			uint32_t result = 0;
+			for (uint32_t direction = 0x80000000u; index != 0; index >>= 1, direction ^= direction >> 1)
+			{
+				if (index & 1)
+				{
+					result ^= direction;
+				}
+			}
+			return result;
+		}
+
+		// Interleaves the bits of x and y: ...y1 x1 y0 x0.
+		inline uint64_t EncodeMorton2(uint32_t x, uint32_t y)
+		{
+			auto spread = [](uint64_t v)
+			{
+				v &= 0xffffffff;
+				v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+				v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+				v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+				v = (v | (v << 2)) & 0x3333333333333333ULL;
+				v = (v | (v << 1)) & 0x5555555555555555ULL;
+				return v;
+			};
+			return (spread(y) << 1) | spread(x);
+		}
+	}
+
+	// Uniform random values, equivalent to drawing from a freshly seeded generator per pixel sample.
+	class IndependentSampler : public Sampler
+	{
+	public:
+		IndependentSampler(uint64_t seed = 0) : Sampler(seed) {}
+
+		virtual void StartPixelSample(int x, int y, int index) override
+		{
+			Sampler::StartPixelSample(x, y, index);
+			random = Random(Hash(seed, x, y, index));
+		}
+
+		virtual double Get1D() override
+		{
+			return random.NextDouble();
+		}
+
+		virtual std::pair<double, double> Get2D() override
+		{
+			auto u1 = random.NextDouble();
+			auto u2 = random.NextDouble();
+			return { u1, u2 };
+		}
+
+		virtual std::unique_ptr<Sampler> Clone() const override
+		{
+			return std::make_unique<IndependentSampler>(*this);
+		}
+
+		virtual const char* Name() const override
+		{
+			return "independent";
+		}
+
+	private:
+		Random random;
+	};
+
+	// Jittered strata over the pixel's samples, assigned to sample indices by a per-dimension permutation.
+	// Needs the number of samples up front, indices past it start a new set of strata.
+	class StratifiedSampler : public Sampler
+	{
+	public:
+		StratifiedSampler(uint64_t seed = 0) : Sampler(seed) {}
+
+		virtual void SetSamplesPerPixel(int samplesPerPixel) override
+		{
+			samplesCount = std::max(1, samplesPerPixel);
+			xStrata = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(samplesCount))));
+			yStrata = (samplesCount + xStrata - 1) / xStrata;
+		}
+
+		virtual void StartPixelSample(int x, int y, int index) override
+		{
+			Sampler::StartPixelSample(x, y, index);
+			random = Random(Hash(seed, x, y, index));
+		}
+
+		virtual double Get1D() override
+		{
+			auto hash = DimensionHash();
+			auto stratum = detail::PermutationElement(StratumIndex(), samplesCount, static_cast<uint32_t>(hash ^ SetHash()));
+			dimension++;
+			return (stratum + random.NextDouble()) / samplesCount;
+		}
+
+		virtual std::pair<double, double> Get2D() override
+		{
+			auto hash = DimensionHash();
+			auto stratum = detail::PermutationElement(StratumIndex(), xStrata * yStrata, static_cast<uint32_t>(hash ^ SetHash()));
+			dimension += 2;
+			auto u1 = ((stratum % xStrata) + random.NextDouble()) / xStrata;
+			auto u2 = ((stratum / xStrata) + random.NextDouble()) / yStrata;
+			return { u1, u2 };
+		}
+
+		virtual std::unique_ptr<Sampler> Clone() const override
+		{
+			return std::make_unique<StratifiedSampler>(*this);
+		}
+
+		virtual const char* Name() const override
+		{
+			return "stratified";
+		}
+
+	private:
+		uint32_t StratumIndex() const
+		{
+			return static_cast<uint32_t>(sampleIndex % samplesCount);
+		}
+
+		uint64_t SetHash() const
+		{
+			return MixBits(sampleIndex / samplesCount);
+		}
+
+		Random random;
+		int samplesCount = 1;
+		int xStrata = 1;
+		int yStrata = 1;
+	};
+
+	// Halton sequence indexed by the sample index, one prime base per dimension. Every pixel and dimension
+	// gets its own Owen scrambling, which keeps the points low-discrepancy while decorrelating pixels.
+	class HaltonSampler : public Sampler
+	{
+	public:
+		HaltonSampler(uint64_t seed = 0) : Sampler(seed) {}
+
+		virtual double Get1D() override
+		{
+			auto u = ScrambledRadicalInverse(dimension % primesCount, sampleIndex, static_cast<uint32_t>(DimensionHash()));
+			dimension++;
+			return u;
+		}
+
+		virtual std::pair<double, double> Get2D() override
+		{
+			auto u1 = Get1D();
+			auto u2 = Get1D();
+			return { u1, u2 };
+		}
+
+		virtual std::unique_ptr<Sampler> Clone() const override
+		{
+			return std::make_unique<HaltonSampler>(*this);
+		}
+
+		virtual const char* Name() const override
+		{
+			return "halton";
+		}
+
+	private:
+		static constexpr int primesCount = 64;
+		static constexpr int primes[primesCount] = {
+			2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+			59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+			137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+			227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311 };
+
+		static double ScrambledRadicalInverse(int baseIndex, uint64_t index, uint32_t hash)
+		{
+			const int base = primes[baseIndex];
+			const double inverseBase = 1.0 / base;
+			double inverseBaseM = 1.0;
+			uint64_t reversedDigits = 0;
+
+			while (index > 0)
+			{
+				uint64_t next = index / base;
+				auto digit = static_cast<uint32_t>(index - next * base);
+				uint32_t digitHash = static_cast<uint32_t>(MixBits(hash ^ reversedDigits));
+				digit = detail::PermutationElement(digit, base, digitHash);
+				reversedDigits = reversedDigits * base + digit;
+				inverseBaseM *= inverseBase;
+				index = next;
+			}
+
+			// The remaining digits are all zero; scrambled independently they form a uniform random tail.
+			auto tail = detail::ToUnitInterval(static_cast<uint32_t>(MixBits(hash ^ reversedDigits ^ 0x7a11u)));
+			return std::min(inverseBaseM * (reversedDigits + tail), consts::oneMinusEpsilon);
+		}
+	};
+
+	// Owen-scrambled Sobol points (Burley 2020). Dimensions are padded in pairs: every pair uses the first
+	// two Sobol dimensions with its own index shuffle and scrambling seeds.
+	class SobolSampler : public Sampler
+	{
+	public:
+		SobolSampler(uint64_t seed = 0) : Sampler(seed) {}
+
+		virtual double Get1D() override
+		{
+			auto hash = DimensionHash();
+			auto index = detail::NestedUniformScramble(static_cast<uint32_t>(sampleIndex), static_cast<uint32_t>(hash));
+			auto u = detail::ToUnitInterval(detail::NestedUniformScramble(detail::SobolDimension0(index), static_cast<uint32_t>(hash >> 32)));
+			dimension++;
+			return u;
+		}
+
+		virtual std::pair<double, double> Get2D() override
+		{
+			auto hash = DimensionHash();
+			auto index = detail::NestedUniformScramble(static_cast<uint32_t>(sampleIndex), static_cast<uint32_t>(hash));
+			auto u1 = detail::ToUnitInterval(detail::NestedUniformScramble(detail::SobolDimension0(index), static_cast<uint32_t>(hash >> 32)));
+			auto u2 = detail::ToUnitInterval(detail::NestedUniformScramble(detail::SobolDimension1(index), static_cast<uint32_t>(MixBits(hash))));
+			dimension += 2;
+			return { u1, u2 };
+		}
+
+		virtual std::unique_ptr<Sampler> Clone() const override
+		{
+			return std::make_unique<SobolSampler>(*this);
+		}
+
+		virtual const char* Name() const override
+		{
+			return "sobol";
+		}
+	};
+
+	// Screen-space blue noise (Ahmed and Wonka 2020): all pixels share one Owen-scrambled Sobol sequence.
+	// A pixel's samples are a block of it, located by the pixel's Morton index with base-4 digits randomly
+	// permuted per dimension. Neighbouring pixels get well-stratified parts of the sequence, so their
+	// errors are negatively correlated and the noise is pushed to high frequencies.
+	// Sample counts are rounded up to a power of two; indices past it start a new, differently scrambled set.
+	class ZSobolSampler : public Sampler
+	{
+	public:
+		ZSobolSampler(int imageWidth, int imageHeight, uint64_t seed = 0) : Sampler(seed), imageWidth(imageWidth), imageHeight(imageHeight)
+		{
+			SetSamplesPerPixel(1);
+		}
+
+		virtual void SetSamplesPerPixel(int samplesPerPixel) override
+		{
+			log2SamplesPerPixel = 0;
+			while ((1 << log2SamplesPerPixel) < samplesPerPixel)
+			{
+				log2SamplesPerPixel++;
+			}
+
+			int log2Resolution = 0;
+			while ((1 << log2Resolution) < std::max(imageWidth, imageHeight))
+			{
+				log2Resolution++;
+			}
+			base4DigitsCount = log2Resolution + (log2SamplesPerPixel + 1) / 2;
+		}
+
+		virtual void StartPixelSample(int x, int y, int index) override
+		{
+			Sampler::StartPixelSample(x, y, index);
+			// The index must stay inside the pixel's block, or it would take the samples of the next pixel.
+			const uint64_t blockMask = (uint64_t(1) << log2SamplesPerPixel) - 1;
+			mortonIndex = (detail::EncodeMorton2(x, y) << log2SamplesPerPixel) | (static_cast<uint64_t>(index) & blockMask);
+			sampleSet = static_cast<uint64_t>(index) >> log2SamplesPerPixel;
+		}
+
+		virtual double Get1D() override
+		{
+			auto index = static_cast<uint32_t>(SampleIndex());
+			auto hash = DimensionSeed();
+			dimension++;
+			return detail::ToUnitInterval(detail::NestedUniformScramble(detail::SobolDimension0(index), static_cast<uint32_t>(hash)));
+		}
+
+		virtual std::pair<double, double> Get2D() override
+		{
+			auto index = static_cast<uint32_t>(SampleIndex());
+			auto hash = DimensionSeed();
+			dimension += 2;
+			auto u1 = detail::ToUnitInterval(detail::NestedUniformScramble(detail::SobolDimension0(index), static_cast<uint32_t>(hash)));
+			auto u2 = detail::ToUnitInterval(detail::NestedUniformScramble(detail::SobolDimension1(index), static_cast<uint32_t>(hash >> 32)));
+			return { u1, u2 };
+		}
+
+		virtual std::unique_ptr<Sampler> Clone() const override
+		{
+			return std::make_unique<ZSobolSampler>(*this);
+		}
+
+		virtual const char* Name() const override
+		{
+			return "zsobol";
+		}
+
+	private:
+		uint64_t DimensionSeed() const
+		{
+			return sampleSet == 0 ? Hash(seed, dimension) : Hash(seed, dimension, sampleSet);
+		}
+
+		// Index into the shared sequence: Morton digits from the top, each permuted by a hash of the digits above it.
+		uint64_t SampleIndex() const
+		{
+			static const uint8_t permutations[24][4] = {
+				{ 0, 1, 2, 3 }, { 0, 1, 3, 2 }, { 0, 2, 1, 3 }, { 0, 2, 3, 1 }, { 0, 3, 2, 1 }, { 0, 3, 1, 2 },
+				{ 1, 0, 2, 3 }, { 1, 0, 3, 2 }, { 1, 2, 0, 3 }, { 1, 2, 3, 0 }, { 1, 3, 2, 0 }, { 1, 3, 0, 2 },
+				{ 2, 1, 0, 3 }, { 2, 1, 3, 0 }, { 2, 0, 1, 3 }, { 2, 0, 3, 1 }, { 2, 3, 0, 1 }, { 2, 3, 1, 0 },
+				{ 3, 1, 2, 0 }, { 3, 1, 0, 2 }, { 3, 2, 1, 0 }, { 3, 2, 0, 1 }, { 3, 0, 2, 1 }, { 3, 0, 1, 2 } };
+
+			uint64_t index = 0;
+			const bool oddPower = log2SamplesPerPixel & 1;
+			const int lastDigit = oddPower ? 1 : 0;
+			const uint64_t dimensionMask = 0x55555555ULL * static_cast<uint64_t>(dimension);
+			for (int i = base4DigitsCount - 1; i >= lastDigit; i--)
+			{
+				int digitShift = 2 * i - (oddPower ? 1 : 0);
+				int digit = (mortonIndex >> digitShift) & 3;
+				uint64_t higherDigits = mortonIndex >> (digitShift + 2);
+				int permutation = (MixBits(higherDigits ^ dimensionMask) >> 24) % 24;
+				index |= static_cast<uint64_t>(permutations[permutation][digit]) << digitShift;
+			}
+
+			if (oddPower)
+			{
+				int digit = mortonIndex & 1;
+				index |= digit ^ (MixBits((mortonIndex >> 1) ^ dimensionMask) & 1);
+			}
+			return index;
+		}
+
+		int imageWidth;
+		int imageHeight;
+		int log2SamplesPerPixel = 0;
+		int base4DigitsCount = 0;
+		uint64_t mortonIndex = 0;
+		uint64_t sampleSet = 0;
+	};
+}
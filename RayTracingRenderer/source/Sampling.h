@@ -0,0 +1,103 @@
+#pragma once
+
+#include "Constants.h"
+#include "Vector3.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Closed-form warps from uniform numbers in [0,1) to common distributions. Every routine consumes
+// a fixed number of dimensions, so they work with any sample source, including low-discrepancy ones.
+namespace rtr::sampling
+{
+	// Shirley-Chiu concentric mapping, preserves stratification of the input. Result lies in the z = 0 plane.
+	inline Vector3 SampleUniformDiskConcentric(double u1, double u2)
+	{
+		auto x = 2.0 * u1 - 1.0;
+		auto y = 2.0 * u2 - 1.0;
+		if (x == 0.0 && y == 0.0)
+		{
+			return Vector3(0.0, 0.0, 0.0);
+		}
+
+		bool xDominant = std::fabs(x) > std::fabs(y);
+		auto r = xDominant ? x : y;
+		auto theta = xDominant ? (consts::pi / 4.0) * (y / x) : (consts::pi / 2.0) - (consts::pi / 4.0) * (x / y);
+		return Vector3(r * std::cos(theta), r * std::sin(theta), 0.0);
+	}
+
+	inline Vector3 SampleUniformSphere(double u1, double u2)
+	{
+		auto z = 1.0 - 2.0 * u1;
+		auto r = std::sqrt(std::max(0.0, 1.0 - z * z));
+		auto phi = 2.0 * consts::pi * u2;
+		return Vector3(r * std::cos(phi), r * std::sin(phi), z);
+	}
+
+	inline double UniformSpherePdf()
+	{
+		return 1.0 / (4.0 * consts::pi);
+	}
+
+	// Uniform point inside the unit ball: direction on the sphere, radius from the cube root of the volume fraction.
+	inline Vector3 SampleUniformBall(double u1, double u2, double u3)
+	{
+		return std::cbrt(u3) * SampleUniformSphere(u1, u2);
+	}
+
+	// Cosine-weighted hemisphere around +z (Malley's method: project the concentric disk up).
+	inline Vector3 SampleCosineHemisphere(double u1, double u2)
+	{
+		auto d = SampleUniformDiskConcentric(u1, u2);
+		auto z = std::sqrt(std::max(0.0, 1.0 - d.X() * d.X() - d.Y() * d.Y()));
+		return Vector3(d.X(), d.Y(), z);
+	}
+
+	inline double CosineHemispherePdf(double cosTheta)
+	{
+		return std::max(0.0, cosTheta) / consts::pi;
+	}
+
+	// Directions in the cone around +z with the given 1 - cos(thetaMax), uniform in solid angle.
+	inline Vector3 SampleUniformCone(double u1, double u2, double oneMinusCosThetaMax)
+	{
+		auto cosTheta = 1.0 - u2 * oneMinusCosThetaMax;
+		auto sinTheta = std::sqrt(std::max(0.0, 1.0 - cosTheta * cosTheta));
+		auto phi = 2.0 * consts::pi * u1;
+		return Vector3(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+	}
+
+	// GGX (Trowbridge-Reitz) microfacet normal around +z, distributed as D(m) * cos(theta_m).
+	inline Vector3 SampleGGX(double alpha, double u1, double u2)
+	{
+		auto tanThetaSquared = alpha * alpha * u1 / (1.0 - u1);
+		auto cosTheta = 1.0 / std::sqrt(1.0 + tanThetaSquared);
+		auto sinTheta = std::sqrt(std::max(0.0, 1.0 - cosTheta * cosTheta));
+		auto phi = 2.0 * consts::pi * u2;
+		return Vector3(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+	}
+
+	inline double GGXDistribution(double alpha, double cosTheta)
+	{
+		if (cosTheta <= 0.0)
+		{
+			return 0.0;
+		}
+		auto alphaSquared = alpha * alpha;
+		auto denominator = cosTheta * cosTheta * (alphaSquared - 1.0) + 1.0;
+		return alphaSquared / (consts::pi * denominator * denominator);
+	}
+
+	inline double GGXPdf(double alpha, double cosTheta)
+	{
+		return GGXDistribution(alpha, cosTheta) * std::max(0.0, cosTheta);
+	}
+
+	// Transforms a direction sampled around +z to the frame around the given unit normal.
+	inline Vector3 ToWorld(const Vector3& local, const Vector3& normal)
+	{
+		Vector3 tangent, bitangent;
+		CoordinateSystem(normal, tangent, bitangent);
+		return local.X() * tangent + local.Y() * bitangent + local.Z() * normal;
+	}
+}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "Environment.h"
 #include "HittableObject.h"
+#include "LightBVH.h"
+#include "Sphere.h"
 
 #include <memory>
 #include <vector>
@@ -15,6 +18,8 @@ namespace rtr
 		void Clear()
 		{
 			objects.clear();
+			lights.clear();
+			lightHierarchy.Build(lights);
 		}
 
 		void Add(std::shared_ptr<Hittable> object)
@@ -22,10 +27,68 @@ namespace rtr
 			objects.push_back(object);
 		}
 
+		// Emissive spheres have to be added as lights, otherwise they are only reached by camera and specular rays.
+		void AddLight(std::shared_ptr<Sphere> light)
+		{
+			objects.push_back(light);
+			lights.push_back(light);
+		}
+
+		void BuildLightHierarchy()
+		{
+			lightHierarchy.Build(lights);
+		}
+
+		bool HasLights() const
+		{
+			return !lights.empty();
+		}
+
+		void SetBackground(const Color& color)
+		{
+			background = color;
+			hasBackgroundColor = true;
+		}
+
+		void SetEnvironment(std::shared_ptr<EnvironmentMap> environmentMap)
+		{
+			environment = environmentMap;
+		}
+
+		const EnvironmentMap* Environment() const
+		{
+			return environment.get();
+		}
+
+		Color Background(const Ray& ray) const
+		{
+			if (environment)
+			{
+				return environment->Radiance(ray.Direction());
+			}
+
+			if (hasBackgroundColor)
+			{
+				return background;
+			}
+
+			Vector3 unitDirection = ray.Direction();
+			auto t = 0.5 * (unitDirection.Y() + 1.0);
+
+			return (1.0 - t) * Color(1.0, 1.0, 1.0) + t * Color(0.5, 0.7, 1.0);
+		}
+
 		bool Hit(const Ray& ray, double tMin, double tMax, HitRecord& hitRecord) const;
 
+		const Sphere* SampleLight(const Point3& point, const Vector3& normal, double u, LightSampling lightSampling, double& pmf) const;
+
 	private:
 		std::vector<std::shared_ptr<Hittable>> objects;
+		std::vector<std::shared_ptr<Sphere>> lights;
+		LightBVH lightHierarchy;
+		std::shared_ptr<EnvironmentMap> environment;
+		Color background;
+		bool hasBackgroundColor = false;
 	};
 
 	bool Scene::Hit(const Ray& ray, double tMin, double tMax, HitRecord& hitRecord) const
@@ -46,4 +109,22 @@ namespace rtr
 
 		return hit;
 	}
+
+	const Sphere* Scene::SampleLight(const Point3& point, const Vector3& normal, double u, LightSampling lightSampling, double& pmf) const
+	{
+		if (lights.empty())
+		{
+			pmf = 0.0;
+			return nullptr;
+		}
+
+		if (lightSampling == LightSampling::Hierarchy && !lightHierarchy.IsEmpty())
+		{
+			return lightHierarchy.Sample(point, normal, u, pmf);
+		}
+
+		auto index = std::min(static_cast<size_t>(u * lights.size()), lights.size() - 1);
+		pmf = 1.0 / lights.size();
+		return lights[index].get();
+	}
 }
@@ -0,0 +1,386 @@
+#pragma once
+
+#include "AccumulationBuffer.h"
+#include "Distributed.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "TileScheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
+namespace rtr
+{
+	namespace detail
+	{
+		inline constexpr uint32_t sharedFramebufferMagic = 0x31465352; // "RSF1"
+
+		// Start of the segment. The tile states and the accumulation buffer storage follow it.
+		struct SharedFramebufferHeader
+		{
+			uint32_t magic = 0;
+			int32_t tileSize = 0;
+			int32_t tilesCount = 0;
+			uint32_t jobSize = 0;
+			char job[maxJobMessageBytes] = {}; // detail::JobPayload of the frame.
+			std::atomic<uint32_t> nextTile{ 0 };
+			std::atomic<uint32_t> tilesDone{ 0 };
+		};
+
+		static_assert(std::atomic<uint64_t>::is_always_lock_free, "Tile claims must work across processes");
+
+		// Tile states: free, done, or claimed by a process, (start << 34) | (pid << 2) | tileClaimed, where start is
+		// the low 30 bits of the process start time, so a claim of an exited process whose pid was reused by another
+		// one does not look alive.
+		inline constexpr uint64_t tileFree = 0;
+		inline constexpr uint64_t tileClaimed = 1;
+		inline constexpr uint64_t tileDone = 2;
+		inline constexpr uint64_t processStartMask = (uint64_t(1) << 30) - 1;
+
+		// Start time of the process in system-specific units, or 0 when it cannot be read.
+		inline uint64_t ProcessStartTime(int processId)
+		{
+#if defined(__linux__)
+			// Field 22 of /proc/<pid>/stat, in clock ticks since boot. The command name before it may contain
+			// spaces, so fields are counted from its closing parenthesis.
+			std::ifstream file("/proc/" + std::to_string(processId) + "/stat");
+			std::string line;
+			if (!std::getline(file, line) || line.rfind(')') == std::string::npos)
+			{
+				return 0;
+			}
+			std::istringstream fields(line.substr(line.rfind(')') + 1));
+			std::string field;
+			for (int index = 3; index <= 22 && (fields >> field); index++)
+			{
+				if (index == 22)
+				{
+					return std::stoull(field);
+				}
+			}
+			return 0;
+#elif defined(__APPLE__)
+			int name[4] = { CTL_KERN, KERN_PROC, KERN_PROC_PID, processId };
+			kinfo_proc info{};
+			size_t size = sizeof(info);
+			if (sysctl(name, 4, &info, &size, nullptr, 0) != 0 || size == 0)
+			{
+				return 0;
+			}
+			return static_cast<uint64_t>(info.kp_proc.p_starttime.tv_sec) * 1000000 + info.kp_proc.p_starttime.tv_usec;
+#else
+			(void)processId;
+			return 0;
+#endif
+		}
+
+		inline size_t AlignUp(size_t bytes, size_t alignment)
+		{
+			return (bytes + alignment - 1) / alignment * alignment;
+		}
+	}
+
+	// An accumulation buffer in a named POSIX shared memory segment that several renderer processes map and fill
+	// tile by tile, so one crashing process does not take the others or the frame down. Tiles are claimed without
+	// locks: a shared counter hands out fresh tiles, and once it runs out, tiles left free or claimed by a process
+	// that no longer exists are taken over with a compare-and-swap. Claims carry the process id and start time, so a
+	// reused pid does not keep a tile claimed, but reclaiming relies on exited workers being reaped by their parent
+	// (zombies still look alive). Unavailable (Create and Open return null) on systems without POSIX shared memory.
+	class SharedFramebuffer
+	{
+	public:
+		struct Claim
+		{
+			int tile = -1;        // -1 when no tile is left to claim right now.
+			bool taken = false;   // Taken over from a process that exited, so the tile may hold partial samples.
+		};
+
+		SharedFramebuffer(const SharedFramebuffer&) = delete;
+		SharedFramebuffer& operator=(const SharedFramebuffer&) = delete;
+
+		~SharedFramebuffer()
+		{
+#if defined(__unix__) || defined(__APPLE__)
+			accumulation.reset();
+			munmap(segment, segmentBytes);
+			if (owner)
+			{
+				shm_unlink(name.c_str());
+			}
+#endif
+		}
+
+		// Creates the zeroed segment for the job's frame, replacing one of the same name. The creator removes the
+		// name again when it destroys the framebuffer; processes that opened it keep their mapping.
+		static std::unique_ptr<SharedFramebuffer> Create(const std::string& name, const DistributedJob& job)
+		{
+			const auto jobPayload = detail::JobPayload(job);
+			if (jobPayload.size() > sizeof(detail::SharedFramebufferHeader::job))
+			{
+				return nullptr;
+			}
+			const auto tiles = SplitIntoTiles(job.imageWidth, job.imageHeight, job.tileSize);
+			const size_t bytes = SegmentBytes(job.imageWidth, job.imageHeight, tiles.size());
+#if defined(__unix__) || defined(__APPLE__)
+			shm_unlink(name.c_str());
+			const int file = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+			if (file < 0)
+			{
+				return nullptr;
+			}
+			void* segment = ftruncate(file, static_cast<off_t>(bytes)) == 0 ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0) : MAP_FAILED;
+			close(file);
+			if (segment == MAP_FAILED)
+			{
+				shm_unlink(name.c_str());
+				return nullptr;
+			}
+
+			auto* header = new (segment) detail::SharedFramebufferHeader();
+			header->tileSize = job.tileSize;
+			header->tilesCount = static_cast<int32_t>(tiles.size());
+			header->jobSize = static_cast<uint32_t>(jobPayload.size());
+			std::copy(jobPayload.begin(), jobPayload.end(), header->job);
+			for (size_t t = 0; t < tiles.size(); t++)
+			{
+				new (TileStates(segment) + t) std::atomic<uint64_t>(detail::tileFree);
+			}
+			std::atomic_thread_fence(std::memory_order_release);
+			header->magic = detail::sharedFramebufferMagic;
+			return std::unique_ptr<SharedFramebuffer>(new SharedFramebuffer(name, segment, bytes, job, true));
+#else
+			(void)bytes;
+			return nullptr;
+#endif
+		}
+
+		static std::unique_ptr<SharedFramebuffer> Open(const std::string& name)
+		{
+#if defined(__unix__) || defined(__APPLE__)
+			const int file = shm_open(name.c_str(), O_RDWR, 0600);
+			if (file < 0)
+			{
+				return nullptr;
+			}
+			struct stat status;
+			void* segment = fstat(file, &status) == 0 && static_cast<size_t>(status.st_size) >= sizeof(detail::SharedFramebufferHeader)
+				? mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, file, 0) : MAP_FAILED;
+			close(file);
+			if (segment == MAP_FAILED)
+			{
+				return nullptr;
+			}
+
+			const auto* header = static_cast<const detail::SharedFramebufferHeader*>(segment);
+			DistributedJob job;
+			const std::vector<char> jobPayload(header->job, header->job + std::min<size_t>(header->jobSize, sizeof(header->job)));
+			// The tile states must match the job's tiles one to one, or a stale or foreign segment would make
+			// workers claim tiles that do not exist or skip some that do.
+			if (header->magic != detail::sharedFramebufferMagic || !detail::ReadJob(jobPayload, job) || header->tileSize != job.tileSize
+				|| header->tilesCount < 0 || static_cast<size_t>(header->tilesCount) != SplitIntoTiles(job.imageWidth, job.imageHeight, job.tileSize).size()
+				|| static_cast<size_t>(status.st_size) < SegmentBytes(job.imageWidth, job.imageHeight, header->tilesCount))
+			{
+				munmap(segment, static_cast<size_t>(status.st_size));
+				return nullptr;
+			}
+			return std::unique_ptr<SharedFramebuffer>(new SharedFramebuffer(name, segment, static_cast<size_t>(status.st_size), job, false));
+#else
+			return nullptr;
+#endif
+		}
+
+		static size_t SegmentBytes(int imageWidth, int imageHeight, size_t tilesCount)
+		{
+			return StorageOffset(tilesCount) + AccumulationBuffer::StorageBytes(imageWidth, imageHeight);
+		}
+
+		size_t SegmentBytes() const
+		{
+			return segmentBytes;
+		}
+
+		const DistributedJob& Job() const
+		{
+			return job;
+		}
+
+		// Samples of every process, in the segment itself.
+		AccumulationBuffer& Accumulation()
+		{
+			return *accumulation;
+		}
+
+		const std::vector<Tile>& Tiles() const
+		{
+			return tiles;
+		}
+
+		Claim ClaimTile()
+		{
+			auto* states = TileStates(segment);
+			const uint64_t claimed = ((processStartTime & detail::processStartMask) << 34) | (static_cast<uint64_t>(static_cast<uint32_t>(processId)) << 2) | detail::tileClaimed;
+			const uint32_t next = Header().nextTile.fetch_add(1, std::memory_order_relaxed);
+			if (next < tiles.size())
+			{
+				// A scan of another process may have taken the tile between the increment and the swap.
+				uint64_t expected = detail::tileFree;
+				if (states[next].compare_exchange_strong(expected, claimed, std::memory_order_acquire))
+				{
+					return { static_cast<int>(next), false };
+				}
+			}
+
+			for (size_t t = 0; t < tiles.size(); t++)
+			{
+				uint64_t state = states[t].load(std::memory_order_relaxed);
+				const bool orphaned = state == detail::tileFree || ((state & 3) == detail::tileClaimed && !IsClaimAlive(state));
+				if (orphaned && states[t].compare_exchange_strong(state, claimed, std::memory_order_acquire))
+				{
+					return { static_cast<int>(t), state != detail::tileFree };
+				}
+			}
+			return {};
+		}
+
+		void CompleteTile(int tile)
+		{
+			TileStates(segment)[tile].store(detail::tileDone, std::memory_order_release);
+			Header().tilesDone.fetch_add(1, std::memory_order_acq_rel);
+		}
+
+		int TilesDone() const
+		{
+			return static_cast<int>(Header().tilesDone.load(std::memory_order_acquire));
+		}
+
+		bool IsComplete() const
+		{
+			return TilesDone() == static_cast<int>(tiles.size());
+		}
+
+	private:
+		SharedFramebuffer(std::string name, void* segment, size_t segmentBytes, const DistributedJob& job, bool owner)
+			: name(std::move(name)), segment(segment), segmentBytes(segmentBytes), job(job), owner(owner)
+		{
+			tiles = SplitIntoTiles(job.imageWidth, job.imageHeight, job.tileSize);
+			accumulation = std::make_unique<AccumulationBuffer>(job.imageWidth, job.imageHeight, static_cast<char*>(segment) + StorageOffset(tiles.size()));
+#if defined(__unix__) || defined(__APPLE__)
+			processId = static_cast<int>(getpid());
+			processStartTime = detail::ProcessStartTime(processId);
+#endif
+		}
+
+		static size_t StorageOffset(size_t tilesCount)
+		{
+			return detail::AlignUp(sizeof(detail::SharedFramebufferHeader) + tilesCount * sizeof(std::atomic<uint64_t>), 64);
+		}
+
+		static std::atomic<uint64_t>* TileStates(void* segment)
+		{
+			return reinterpret_cast<std::atomic<uint64_t>*>(static_cast<char*>(segment) + sizeof(detail::SharedFramebufferHeader));
+		}
+
+		// Whether the process that made the claim still runs: a process with its pid exists and, where start times
+		// were and can be read, started at the same time.
+		static bool IsClaimAlive(uint64_t claim)
+		{
+			const int claimProcessId = static_cast<int>((claim >> 2) & 0xffffffffu);
+			if (!IsProcessAlive(claimProcessId))
+			{
+				return false;
+			}
+			const uint64_t startTime = detail::ProcessStartTime(claimProcessId);
+			return startTime == 0 || claim >> 34 == 0 || (startTime & detail::processStartMask) == claim >> 34;
+		}
+
+		static bool IsProcessAlive(int processId)
+		{
+#if defined(__unix__) || defined(__APPLE__)
+			return kill(processId, 0) == 0 || errno == EPERM;
+#else
+			(void)processId;
+			return true;
+#endif
+		}
+
+		detail::SharedFramebufferHeader& Header() const
+		{
+			return *static_cast<detail::SharedFramebufferHeader*>(segment);
+		}
+
+		std::string name;
+		void* segment;
+		size_t segmentBytes;
+		DistributedJob job;
+		bool owner;
+		int processId = 0;
+		uint64_t processStartTime = 0;
+		std::vector<Tile> tiles;
+		std::unique_ptr<AccumulationBuffer> accumulation;
+	};
+
+	// Renders tiles of the framebuffer with threadsCount threads (all hardware threads for 0) until every tile is
+	// done, taking over tiles of processes that exit on the way. Returns the number of tiles this process rendered,
+	// -1 when the factory does not know the job's scene.
+	inline int RunSharedFramebufferWorker(SharedFramebuffer& framebuffer, const SceneFactory& sceneFactory, int threadsCount = 0)
+	{
+		const DistributedJob& job = framebuffer.Job();
+		const auto scene = detail::BuildScene(sceneFactory, job.scene);
+		if (scene == nullptr)
+		{
+			return -1;
+		}
+		const Camera camera = job.camera.Create();
+		Renderer renderer(job.imageWidth, job.imageHeight);
+		renderer.SetSeed(job.seed);
+		renderer.SetThreadsCount(threadsCount);
+		renderer.ClearProgressSubscribers();
+
+		int tilesCount = 0;
+		while (!framebuffer.IsComplete())
+		{
+			const auto claim = framebuffer.ClaimTile();
+			if (claim.tile < 0)
+			{
+				// The rest is in flight; keep watching in case one of its processes exits.
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+				continue;
+			}
+
+			const Tile& tile = framebuffer.Tiles()[claim.tile];
+			if (claim.taken)
+			{
+				for (int y = tile.y0; y < tile.y1; y++)
+				{
+					framebuffer.Accumulation().ClearRow(y, tile.x0, tile.x1);
+				}
+			}
+			renderer.SetCropWindow(tile);
+			renderer.RenderToSampleCount(camera, *scene, job.samplesPerPixel, job.maxDepth, framebuffer.Accumulation());
+			framebuffer.CompleteTile(claim.tile);
+			tilesCount++;
+		}
+		return tilesCount;
+	}
+}
@@ -1,6 +1,8 @@
 #pragma once
 
+#include "AABB.h"
 #include "HittableObject.h"
+#include "Sampling.h"
 #include "Vector3.h"
 
 namespace rtr
@@ -13,6 +15,20 @@ namespace rtr
 
 		virtual bool Hit(const Ray& ray, double tMin, double tMax, HitRecord& record) const override;
 
+		AABB BoundingBox() const
+		{
+			auto r = std::fabs(radius);
+			return AABB(center - Vector3(r, r, r), center + Vector3(r, r, r));
+		}
+
+		double Area() const
+		{
+			return 4.0 * consts::pi * radius * radius;
+		}
+
+		// Samples a direction from origin towards the cone subtended by the sphere.
+		bool SampleDirection(const Point3& origin, double u1, double u2, Vector3& direction, double& pdf) const;
+
 		Point3 center;
 		double radius;
 		std::shared_ptr<Material> material;
@@ -50,4 +66,23 @@ namespace rtr
 
 		return true;
 	}
+
+	bool Sphere::SampleDirection(const Point3& origin, double u1, double u2, Vector3& direction, double& pdf) const
+	{
+		Vector3 toCenter = center - origin;
+		auto distanceSquared = toCenter.LengthSquared();
+		auto radiusSquared = radius * radius;
+		if (distanceSquared <= radiusSquared)
+		{
+			return false;
+		}
+
+		// 1 - cos(thetaMax) written to stay accurate for tiny, distant spheres.
+		auto sinThetaMaxSquared = radiusSquared / distanceSquared;
+		auto oneMinusCosThetaMax = sinThetaMaxSquared / (1.0 + std::sqrt(1.0 - sinThetaMaxSquared));
+
+		direction = sampling::ToWorld(sampling::SampleUniformCone(u1, u2, oneMinusCosThetaMax), toCenter / std::sqrt(distanceSquared));
+		pdf = 1.0 / (2.0 * consts::pi * oneMinusCosThetaMax);
+		return true;
+	}
 }
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rtr::stats
+{
+	// Rays traced by the current thread (camera, bounce and shadow rays). Thread local, so counting
+	// costs a plain increment and never contends between workers; callers sum it up per thread.
+	inline thread_local uint64_t raysTraced = 0;
+
+	struct ProgressSnapshot
+	{
+		uint64_t tilesDone = 0;
+		uint64_t tilesTotal = 0;   // Zero when not known up front (time budgets, adaptive sampling).
+		uint64_t samplesDone = 0;
+		uint64_t raysTraced = 0;
+		double elapsedMs = 0.0;
+		double remainingMs = -1.0; // Estimated from the tiles done so far, negative when unknown.
+		bool finished = false;
+	};
+
+	using ProgressCallback = std::function<void(const ProgressSnapshot&)>;
+
+	// Counters of the current render. Workers add to them once per tile with relaxed atomics, so they never
+	// wait on each other or on readers; any thread can take a snapshot at any time.
+	class RenderProgress
+	{
+	public:
+		void Start(uint64_t tilesTotalCount)
+		{
+			tilesDone.store(0, std::memory_order_relaxed);
+			samplesDone.store(0, std::memory_order_relaxed);
+			rays.store(0, std::memory_order_relaxed);
+			tilesTotal.store(tilesTotalCount, std::memory_order_relaxed);
+			startTicks.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+		}
+
+		void AddTile(uint64_t samplesCount, uint64_t raysCount)
+		{
+			samplesDone.fetch_add(samplesCount, std::memory_order_relaxed);
+			rays.fetch_add(raysCount, std::memory_order_relaxed);
+			tilesDone.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		ProgressSnapshot Snapshot() const
+		{
+			ProgressSnapshot snapshot;
+			snapshot.tilesDone = tilesDone.load(std::memory_order_relaxed);
+			snapshot.tilesTotal = tilesTotal.load(std::memory_order_relaxed);
+			snapshot.samplesDone = samplesDone.load(std::memory_order_relaxed);
+			snapshot.raysTraced = rays.load(std::memory_order_relaxed);
+			const auto start = Clock::time_point(Clock::duration(startTicks.load(std::memory_order_relaxed)));
+			snapshot.elapsedMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			if (snapshot.tilesTotal > 0 && snapshot.tilesDone > 0)
+			{
+				const double remainingTiles = static_cast<double>(snapshot.tilesTotal) - static_cast<double>(snapshot.tilesDone);
+				snapshot.remainingMs = std::max(0.0, snapshot.elapsedMs * remainingTiles / snapshot.tilesDone);
+			}
+			return snapshot;
+		}
+
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		std::atomic<uint64_t> tilesDone = 0;
+		std::atomic<uint64_t> tilesTotal = 0;
+		std::atomic<uint64_t> samplesDone = 0;
+		std::atomic<uint64_t> rays = 0;
+		std::atomic<Clock::rep> startTicks = 0;
+	};
+
+	// Calls the subscribers with a snapshot every interval from its own thread while it exists, and once
+	// more with the final snapshot when destroyed. Workers never call subscribers, so slow ones cannot stall them.
+	class ProgressReporter
+	{
+	public:
+		ProgressReporter(const RenderProgress& progress, const std::vector<ProgressCallback>& subscribers, double intervalMs)
+			: progress(progress), subscribers(subscribers)
+		{
+			if (subscribers.empty())
+			{
+				return;
+			}
+
+			thread = std::thread([this, intervalMs]()
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					while (!stopCondition.wait_for(lock, std::chrono::duration<double, std::milli>(intervalMs), [this]() { return stopping; }))
+					{
+						Notify(this->progress.Snapshot());
+					}
+				});
+		}
+
+		~ProgressReporter()
+		{
+			if (!thread.joinable())
+			{
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			stopCondition.notify_one();
+			thread.join();
+
+			auto snapshot = progress.Snapshot();
+			snapshot.finished = true;
+			snapshot.remainingMs = 0.0;
+			Notify(snapshot);
+		}
+
+	private:
+		void Notify(const ProgressSnapshot& snapshot) const
+		{
+			for (const auto& subscriber : subscribers)
+			{
+				subscriber(snapshot);
+			}
+		}
+
+		const RenderProgress& progress;
+		const std::vector<ProgressCallback>& subscribers;
+		std::thread thread;
+		std::mutex mutex;
+		std::condition_variable stopCondition;
+		bool stopping = false;
+	};
+
+	// Subscriber printing one line per report to standard output.
+	inline ProgressCallback StdoutProgress()
+	{
+		return [](const ProgressSnapshot& snapshot)
+		{
+			std::cout << (snapshot.finished ? "Finished: " : "Progress: ");
+			if (snapshot.tilesTotal > 0)
+			{
+				std::cout << "tiles " << snapshot.tilesDone << "/" << snapshot.tilesTotal << ", ";
+			}
+			std::cout << "samples " << snapshot.samplesDone << ", Mrays " << snapshot.raysTraced / 1e6 << ", elapsed " << snapshot.elapsedMs / 1000.0 << " s";
+			if (!snapshot.finished && snapshot.remainingMs >= 0.0)
+			{
+				std::cout << ", ETA " << snapshot.remainingMs / 1000.0 << " s";
+			}
+			std::cout << '\n';
+		};
+	}
+
+	// Nearest-rank percentile, fraction in [0, 1]; zero for no values.
+	inline double Percentile(std::vector<double> values, double fraction)
+	{
+		if (values.empty())
+		{
+			return 0.0;
+		}
+		const size_t rank = std::min(values.size() - 1, static_cast<size_t>(std::ceil(fraction * values.size())) - (fraction > 0.0 ? 1 : 0));
+		std::nth_element(values.begin(), values.begin() + rank, values.end());
+		return values[rank];
+	}
+}
@@ -0,0 +1,285 @@
+#pragma once
+
+#include "Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace rtr
+{
+	// Rectangle of pixels [x0, x1) x [y0, y1), rows counted from the top of the image.
+	struct Tile
+	{
+		int x0 = 0;
+		int y0 = 0;
+		int x1 = 0;
+		int y1 = 0;
+	};
+
+	// Order of the tile list. The scheduler gives each worker a contiguous range of it, so along the Morton
+	// and Hilbert curves every worker stays in a compact region of the image and keeps touching the same part
+	// of the scene. Spiral starts at the image center for interactive previews.
+	enum class TileOrder
+	{
+		Scanline,
+		Morton,
+		Hilbert,
+		Spiral
+	};
+
+	namespace detail
+	{
+		inline uint64_t MortonIndex(uint32_t x, uint32_t y)
+		{
+			uint64_t index = 0;
+			for (int bit = 0; bit < 32; bit++)
+			{
+				index |= (static_cast<uint64_t>((x >> bit) & 1) << (2 * bit)) | (static_cast<uint64_t>((y >> bit) & 1) << (2 * bit + 1));
+			}
+			return index;
+		}
+
+		// Distance of cell (x, y) along the Hilbert curve through a size x size grid, size a power of two.
+		inline uint64_t HilbertIndex(uint32_t size, uint32_t x, uint32_t y)
+		{
+			uint64_t index = 0;
+			for (uint32_t s = size / 2; s > 0; s /= 2)
+			{
+				const uint32_t rx = (x & s) > 0;
+				const uint32_t ry = (y & s) > 0;
+				index += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+				// Rotate the quadrant so the curve continues where the previous one ended.
+				if (ry == 0)
+				{
+					if (rx == 1)
+					{
+						x = size - 1 - x;
+						y = size - 1 - y;
+					}
+					std::swap(x, y);
+				}
+			}
+			return index;
+		}
+	}
+
+	// Tiles covering region, aligned to its top left corner.
+	inline std::vector<Tile> SplitIntoTiles(const Tile& region, int tileSize, TileOrder order = TileOrder::Scanline)
+	{
+		std::vector<Tile> tiles;
+		for (int y = region.y0; y < region.y1; y += tileSize)
+		{
+			for (int x = region.x0; x < region.x1; x += tileSize)
+			{
+				tiles.push_back({ x, y, std::min(x + tileSize, region.x1), std::min(y + tileSize, region.y1) });
+			}
+		}
+		if (order == TileOrder::Scanline || tiles.empty())
+		{
+			return tiles;
+		}
+
+		const int tilesX = (region.x1 - region.x0 + tileSize - 1) / tileSize;
+		const int tilesY = (region.y1 - region.y0 + tileSize - 1) / tileSize;
+		uint32_t gridSize = 1;
+		while (gridSize < static_cast<uint32_t>(std::max(tilesX, tilesY)))
+		{
+			gridSize *= 2;
+		}
+
+		// Spiral: ring around the center first, then the angle within the ring. Rings have the aspect ratio of
+		// the image, so a centered region of any size is finished after about its share of the tiles.
+		const double aspect = static_cast<double>(tilesX) / tilesY;
+		auto key = [&](const Tile& tile) -> std::pair<double, double>
+		{
+			const uint32_t x = (tile.x0 - region.x0) / tileSize;
+			const uint32_t y = (tile.y0 - region.y0) / tileSize;
+			switch (order)
+			{
+			case TileOrder::Morton:
+				return { static_cast<double>(detail::MortonIndex(x, y)), 0.0 };
+			case TileOrder::Hilbert:
+				return { static_cast<double>(detail::HilbertIndex(gridSize, x, y)), 0.0 };
+			default:
+			{
+				const double dx = x - (tilesX - 1) / 2.0;
+				const double dy = y - (tilesY - 1) / 2.0;
+				return { std::round(std::max(std::abs(dx), std::abs(dy) * aspect)), std::atan2(dy * aspect, dx) };
+			}
+			}
+		};
+		std::stable_sort(tiles.begin(), tiles.end(), [&](const Tile& a, const Tile& b) { return key(a) < key(b); });
+		return tiles;
+	}
+
+	inline std::vector<Tile> SplitIntoTiles(int imageWidth, int imageHeight, int tileSize, TileOrder order = TileOrder::Scanline)
+	{
+		return SplitIntoTiles(Tile{ 0, 0, imageWidth, imageHeight }, tileSize, order);
+	}
+
+	// Runs a function for every tile on workers of the threading backend. Each worker starts with a contiguous
+	// range of tiles, takes tiles from its front and, once empty, steals the back half of another worker's range.
+	// A range is a pair of 32-bit indices in one atomic word, so taking and stealing are single CAS
+	// operations and no lock is held at any point. Tiles are never added, so a range value cannot reappear (no ABA).
+	class TileScheduler
+	{
+	public:
+		TileScheduler(int workersCount) : workersCount(std::max(1, workersCount)) {}
+
+		// Workers check shouldStop before taking a tile; once it returns true the remaining tiles are skipped.
+		void Run(const std::vector<Tile>& tiles, const std::function<void(const Tile&)>& tileFunction, const std::function<bool()>& shouldStop = nullptr)
+		{
+			ranges = std::make_unique<Range[]>(workersCount);
+			for (int worker = 0; worker < workersCount; worker++)
+			{
+				ranges[worker].value.store(InitialRange(worker, tiles.size()), std::memory_order_relaxed);
+			}
+
+			auto workerLoop = [&](int worker)
+			{
+				uint32_t tile;
+				while ((!shouldStop || !shouldStop()) && (Pop(worker, tile) || (Steal(worker) && Pop(worker, tile))))
+				{
+					tileFunction(tiles[tile]);
+				}
+			};
+
+			// A worker that starts late finds its tiles stolen, so workers never wait for each other.
+			parallel::Run(workersCount, workersCount, workerLoop);
+		}
+
+		// Runs every worker on its initial range only, without stealing. With pinned threads each tile is
+		// processed on the NUMA node that starts out owning it in Run, e.g. to first-touch its memory there.
+		void RunOwned(const std::vector<Tile>& tiles, const std::function<void(const Tile&)>& tileFunction)
+		{
+			parallel::Run(workersCount, workersCount, [&](int worker)
+				{
+					uint64_t range = InitialRange(worker, tiles.size());
+					for (uint32_t tile = Begin(range); tile < End(range); tile++)
+					{
+						tileFunction(tiles[tile]);
+					}
+				});
+		}
+
+		// Reorders an ordered tile list so that the workers' initial ranges take turns over it: worker 0 gets
+		// tiles 0, workersCount, ..., worker 1 tiles 1, workersCount + 1, ... All workers then advance through
+		// the order together, as with a shared queue, instead of each starting at its own offset.
+		std::vector<Tile> Interleave(const std::vector<Tile>& tiles) const
+		{
+			std::vector<uint32_t> next(workersCount), end(workersCount);
+			for (int worker = 0; worker < workersCount; worker++)
+			{
+				const uint64_t range = InitialRange(worker, tiles.size());
+				next[worker] = Begin(range);
+				end[worker] = End(range);
+			}
+
+			std::vector<Tile> interleaved(tiles.size());
+			int worker = 0;
+			for (const auto& tile : tiles)
+			{
+				while (next[worker] == end[worker])
+				{
+					worker = (worker + 1) % workersCount;
+				}
+				interleaved[next[worker]++] = tile;
+				worker = (worker + 1) % workersCount;
+			}
+			return interleaved;
+		}
+
+	private:
+		uint64_t InitialRange(int worker, size_t tilesCount) const
+		{
+			uint32_t begin = static_cast<uint32_t>(uint64_t(tilesCount) * worker / workersCount);
+			uint32_t end = static_cast<uint32_t>(uint64_t(tilesCount) * (worker + 1) / workersCount);
+			return Pack(begin, end);
+		}
+
+		// Own cache line per range, workers update their own range on every tile.
+		struct alignas(64) Range
+		{
+			std::atomic<uint64_t> value;
+		};
+
+		static uint64_t Pack(uint32_t begin, uint32_t end)
+		{
+			return (static_cast<uint64_t>(begin) << 32) | end;
+		}
+
+		static uint32_t Begin(uint64_t range)
+		{
+			return static_cast<uint32_t>(range >> 32);
+		}
+
+		static uint32_t End(uint64_t range)
+		{
+			return static_cast<uint32_t>(range);
+		}
+
+		bool Pop(int worker, uint32_t& tile)
+		{
+			auto& range = ranges[worker].value;
+			uint64_t current = range.load(std::memory_order_acquire);
+			while (Begin(current) < End(current))
+			{
+				if (range.compare_exchange_weak(current, Pack(Begin(current) + 1, End(current)), std::memory_order_acq_rel))
+				{
+					tile = Begin(current);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Moves the back half of the fullest other range to this worker. Fails only when no work is left.
+		bool Steal(int thief)
+		{
+			while (true)
+			{
+				int victim = -1;
+				uint32_t victimSize = 0;
+				for (int offset = 1; offset < workersCount; offset++)
+				{
+					int worker = (thief + offset) % workersCount;
+					uint64_t range = ranges[worker].value.load(std::memory_order_acquire);
+					uint32_t size = End(range) > Begin(range) ? End(range) - Begin(range) : 0;
+					if (size > victimSize)
+					{
+						victim = worker;
+						victimSize = size;
+					}
+				}
+				if (victim < 0)
+				{
+					return false;
+				}
+
+				auto& victimRange = ranges[victim].value;
+				uint64_t current = victimRange.load(std::memory_order_acquire);
+				if (Begin(current) >= End(current))
+				{
+					continue;
+				}
+				uint32_t size = End(current) - Begin(current);
+				uint32_t split = End(current) - std::max(1u, size / 2);
+				if (victimRange.compare_exchange_strong(current, Pack(Begin(current), split), std::memory_order_acq_rel))
+				{
+					// Only the owner refills its own empty range, so a plain store is enough.
+					ranges[thief].value.store(Pack(split, End(current)), std::memory_order_release);
+					return true;
+				}
+			}
+		}
+
+		int workersCount;
+		std::unique_ptr<Range[]> ranges;
+	};
+}
@@ -1,9 +1,9 @@
 #pragma once
 
 #include "Constants.h"
-
-#include <random>
-#include <cstdlib>
+#include "Random.h"
+#include "Sampler.h"
+#include "Sampling.h"
 
 namespace rtr::util
 {
@@ -12,79 +12,60 @@ namespace rtr::util
         return degreses * consts::pi / 180.0;
     }
 
-    //inline double random_double() {
-    //    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    //    static std::mt19937 generator;
-    //    return distribution(generator);
-    //}
-
-    inline double RandomDouble()
+    inline double RandomDouble(Random& random)
     {
         // Random double in [0,1).
-        return rand() / (RAND_MAX + 1.0);
+        return random.NextDouble();
     }
 
-    inline double RandomDouble(double min, double max)
+    inline double RandomDouble(Random& random, double min, double max)
     {
         // Random double in [min,max).
-        return min + (max - min) * RandomDouble();
+        return min + (max - min) * RandomDouble(random);
     }
 
-    inline Vector3 RandomVector()
+    inline Vector3 RandomVector(Random& random)
     {
-        return Vector3(RandomDouble(), RandomDouble(), RandomDouble());
+        return Vector3(RandomDouble(random), RandomDouble(random), RandomDouble(random));
     }
 
-    inline Color RandomColor()
+    inline Color RandomColor(Random& random)
     {
-        return Color(RandomDouble(), RandomDouble(), RandomDouble());
+        return Color(RandomDouble(random), RandomDouble(random), RandomDouble(random));
     }
 
-    inline Vector3 RandomVector(double min, double max)
+    inline Vector3 RandomVector(Random& random, double min, double max)
     {
-        return Vector3(RandomDouble(min, max), RandomDouble(min, max), RandomDouble(min, max));
+        return Vector3(RandomDouble(random, min, max), RandomDouble(random, min, max), RandomDouble(random, min, max));
     }
 
-    inline Color RandomColor(double min, double max)
+    inline Color RandomColor(Random& random, double min, double max)
     {
-        return Color(RandomDouble(min, max), RandomDouble(min, max), RandomDouble(min, max));
+        return Color(RandomDouble(random, min, max), RandomDouble(random, min, max), RandomDouble(random, min, max));
     }
 
-    Vector3 RandomVectorInUnitSphere()
+    // Closed-form warps, each call consumes a fixed number of sampler dimensions.
+    Vector3 RandomVectorInUnitSphere(Sampler& sampler)
     {
-        while (true)
-        {
-            auto v = RandomVector(-1, 1);
-            if (v.LengthSquared() >= 1)
-            {
-                continue;
-            }
-            return v;
-        }
+        auto [u1, u2] = sampler.Get2D();
+        return sampling::SampleUniformBall(u1, u2, sampler.Get1D());
     }
 
-    Vector3 RandomVectorInUnitDisk()
+    Vector3 RandomVectorInUnitDisk(Sampler& sampler)
     {
-        // TODO: Better random selection - barycentric 
-        while (true)
-        {
-            auto vector = Vector3(RandomDouble(-1, 1), RandomDouble(-1, 1), 0);
-            if (vector.LengthSquared() >= 1)
-            {
-                continue;
-            }
-            return vector;
-        }
+        auto [u1, u2] = sampler.Get2D();
+        return sampling::SampleUniformDiskConcentric(u1, u2);
     }
 
-    Vector3 RandomUnitVector()
+    Vector3 RandomUnitVector(Sampler& sampler)
     {
-        return Normalize(RandomVectorInUnitSphere());
+        auto [u1, u2] = sampler.Get2D();
+        return sampling::SampleUniformSphere(u1, u2);
     }
 
-    Vector3 RandomVectorInHemisphere(const Vector3& normal)
+    Vector3 RandomVectorInHemisphere(Sampler& sampler, const Vector3& normal)
     {
-        auto vector = RandomVectorInUnitSphere();
+        auto vector = RandomVectorInUnitSphere(sampler);
         if (Dot(vector, normal) > 0.0)
         {
             return vector;
@@ -95,6 +76,12 @@ namespace rtr::util
         }
     }
 
+    Vector3 RandomCosineDirection(Sampler& sampler, const Vector3& normal)
+    {
+        auto [u1, u2] = sampler.Get2D();
+        return sampling::ToWorld(sampling::SampleCosineHemisphere(u1, u2), normal);
+    }
+
     double Reflectance(double cosine, double refractionIndex)
     {
         // Schlick's approximation for reflectance.
@@ -145,6 +145,16 @@ namespace rtr
 		return v / v.Lenght();
 	}
 
+	inline void CoordinateSystem(const Vector3& v1, Vector3& v2, Vector3& v3)
+	{
+		// Orthonormal basis around unit vector v1 (Duff et al. 2017), no branches on the vector orientation.
+		double sign = std::copysign(1.0, v1.Z());
+		double a = -1.0 / (sign + v1.Z());
+		double b = v1.X() * v1.Y() * a;
+		v2 = Vector3(1.0 + sign * v1.X() * v1.X() * a, sign * b, -sign * v1.X());
+		v3 = Vector3(b, sign + v1.Y() * v1.Y() * a, -v1.Y());
+	}
+
 	Vector3 Reflect(const Vector3& v, const Vector3& n)
 	{
 		return v - 2 * Dot(v, n) * n;